@@ -0,0 +1,131 @@
+#include "d2x_runtime/d2x_runtime.h"
+#include <chrono>
+#include <map>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <sys/resource.h>
+#include <unistd.h>
+#define UNW_LOCAL_ONLY
+#include <libunwind.h>
+
+// Runs the runtime queries in-process against the program produced by bench_gen and reports
+// p50/p99 latencies and memory as JSON. Every section calls d2x_bench_probe from the middle 
+// of its generated function, the queries run there while the frame is live.
+// Usage: bench [<output file>] [<warm iterations>]
+
+extern void (*d2x_bench_fns[])(volatile int*);
+extern int d2x_bench_sections;
+extern int d2x_bench_lines;
+extern int d2x_bench_vars;
+
+void d2x_bench_probe(int section);
+
+static int warm_iterations = 100;
+static std::map<std::string, std::vector<double>> samples;
+
+template <typename F>
+static void measure(const char* name, F f) {
+	auto begin = std::chrono::steady_clock::now();
+	f();
+	auto end = std::chrono::steady_clock::now();
+	samples[name].push_back(std::chrono::duration<double, std::nano>(end - begin).count());
+}
+
+static double percentile(std::vector<double> &values, double p) {
+	std::sort(values.begin(), values.end());
+	size_t index = (size_t)(p * (values.size() - 1));
+	return values[index];
+}
+
+static long current_rss_kb(void) {
+	std::ifstream statm("/proc/self/statm");
+	long pages = 0, resident = 0;
+	statm >> pages >> resident;
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void d2x_bench_probe(int section) {
+	using namespace d2x::runtime;
+	// Registers of the generated function that called the probe
+	unw_context_t context;
+	unw_cursor_t cursor;
+	unw_getcontext(&context);
+	unw_init_local(&cursor, &context);
+	if (unw_step(&cursor) <= 0)
+		return;
+	unw_word_t ip, sp, bp, bx;
+	unw_get_reg(&cursor, UNW_REG_IP, &ip);
+	unw_get_reg(&cursor, UNW_REG_SP, &sp);
+	unw_get_reg(&cursor, UNW_X86_64_RBP, &bp);
+	unw_get_reg(&cursor, UNW_X86_64_RBX, &bx);
+
+	struct d2x_context ctx;
+	// The first lookup of a PC misses all caches
+	measure(section == 0 ? "find_context_first" : "find_context_cold", [&]() { 
+		ctx = find_context((void*)ip, (void*)sp, (void*)bp, (void*)bx); 
+	});
+	if (ctx.header == nullptr) {
+		std::cerr << "Section " << section << " was not matched" << std::endl;
+		return;
+	}
+
+	// The first lookup of a DSL line builds the break index, later sections only look up 
+	// their own file for the first time
+	std::string file = "bench_" + std::to_string(section) + ".dsl";
+	int line = d2x_bench_lines / 2 + 2;
+	measure(section == 0 ? "find_all_breaks_first" : "find_all_breaks_cold", [&]() { find_all_breaks(ctx, file, line); });
+	measure("find_var_loc_cold", [&]() { find_var_loc(ctx, "x"); });
+	for (int i = 0; i < warm_iterations; i++) {
+		measure("find_context_warm", [&]() { ctx = find_context((void*)ip, (void*)sp, (void*)bp, (void*)bx); });
+		measure("get_backtrace", [&]() { get_backtrace(ctx); });
+		measure("get_vars", [&]() { get_vars(ctx, ""); });
+		measure("get_vars_resolved", [&]() { get_vars(ctx, "x"); });
+		measure("find_all_breaks_warm", [&]() { find_all_breaks(ctx, file, line); });
+		measure("find_var_loc_warm", [&]() { find_var_loc(ctx, "x"); });
+	}
+}
+
+int main(int argc, char* argv[]) {
+	const char* output = argc > 1 ? argv[1] : nullptr;
+	if (argc > 2)
+		warm_iterations = atoi(argv[2]);
+
+	if (d2x::runtime::load_backend()) 
+		return -1;
+	long rss_before = current_rss_kb();
+	volatile int x[16] = {0};
+	for (int s = 0; s < d2x_bench_sections; s++)
+		d2x_bench_fns[s](x);
+	long rss_after = current_rss_kb();
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	std::ostringstream oss;
+	oss << "{\n";
+	oss << "\t\"sections\": " << d2x_bench_sections << ",\n";
+	oss << "\t\"lines\": " << d2x_bench_lines << ",\n";
+	oss << "\t\"vars\": " << d2x_bench_vars << ",\n";
+	oss << "\t\"warm_iterations\": " << warm_iterations << ",\n";
+	oss << "\t\"latency_ns\": {\n";
+	bool first = true;
+	for (auto &s: samples) {
+		if (!first)
+			oss << ",\n";
+		first = false;
+		oss << "\t\t\"" << s.first << "\": {\"count\": " << s.second.size() << ", \"p50\": " << percentile(s.second, 0.5) 
+			<< ", \"p99\": " << percentile(s.second, 0.99) << "}";
+	}
+	oss << "\n\t},\n";
+	oss << "\t\"rss_kb\": {\"before\": " << rss_before << ", \"after\": " << rss_after 
+		<< ", \"max\": " << usage.ru_maxrss << "}\n";
+	oss << "}\n";
+
+	if (output == nullptr) 
+		std::cout << oss.str();
+	else {
+		std::ofstream output_file(output);
+		output_file << oss.str();
+	}
+	return 0;
+}
@@ -0,0 +1,76 @@
+#include "d2x/d2x.h"
+#include <iostream>
+#include <cstdlib>
+
+// Generates a synthetic program for the runtime benchmark. Each section is a function with 
+// the given number of lines and live vars, and a two level extended stack on every line. 
+// The middle line of each section calls d2x_bench_probe, where the driver runs the queries
+// Usage: bench_gen [<sections> [<lines per section> [<vars per line>]]]
+
+static builder::dyn_var<char*(int)> to_str(builder::as_global("std::to_string"));	
+static builder::dyn_var<int*(void*)> to_int_p(builder::as_global("(int*)"));
+
+int main(int argc, char* argv[]) {
+	int sections = argc > 1 ? atoi(argv[1]) : 100;
+	int lines = argc > 2 ? atoi(argv[2]) : 50;
+	int vars = argc > 3 ? atoi(argv[3]) : 8;
+
+	std::cout << "#include <string>\n";
+	std::cout << "#include \"d2x_runtime/d2x_runtime_core.h\"\n";
+	std::cout << "void d2x_bench_probe(int section);\n";
+
+	// Resolves the value of x through the DWARF info of the generated function
+	d2x::runtime_value_resolver r ([&](auto v) -> auto {
+		builder::dyn_var<int*> addr = to_int_p(d2x::rt::find_stack_var(v));
+		return "x = " + to_str(addr[0]);
+	});
+
+	d2x::d2x_context context;
+	for (int s = 0; s < sections; s++) {
+		std::string file = "bench_" + std::to_string(s) + ".dsl";
+		std::string kernel = "kernel_" + std::to_string(s);
+		std::cout << context.begin_section();
+
+		context.push_source_loc({file, 1, kernel, 0});
+		context.push_source_loc({"bench_main.dsl", s + 1, "main", s});
+		std::cout << "void d2x_bench_fn_" << s << "(volatile int* x) {" << std::endl;
+		context.nextl();
+
+		context.create_var("x");
+		context.update_var("x", r);
+		context.set_var_here("x", r);
+		for (int v = 0; v < vars; v++) {
+			std::string name = "v" + std::to_string(v);
+			context.create_var(name);
+			context.update_var(name, std::to_string(v));
+			context.set_var_here(name, std::to_string(v));
+		}
+
+		for (int l = 0; l < lines; l++) {
+			context.push_source_loc({file, l + 2, kernel, l + 1});
+			context.push_source_loc({"bench_main.dsl", s + 1, "main", s});
+			if (l == lines / 2)
+				std::cout << "\td2x_bench_probe(" << s << ");" << std::endl;
+			else
+				std::cout << "\tx[" << l % 16 << "] += " << l << ";" << std::endl;
+			context.nextl();
+		}
+
+		context.push_source_loc({file, lines + 2, kernel, lines + 1});
+		context.push_source_loc({"bench_main.dsl", s + 1, "main", s});
+		std::cout << "}" << std::endl;
+		context.nextl();
+
+		context.emit_function_info(std::cout);
+		context.end_section();
+	}
+
+	std::cout << "void (*d2x_bench_fns[])(volatile int*) = {\n";
+	for (int s = 0; s < sections; s++) 
+		std::cout << "\td2x_bench_fn_" << s << ",\n";
+	std::cout << "};\n";
+	std::cout << "int d2x_bench_sections = " << sections << ";\n";
+	std::cout << "int d2x_bench_lines = " << lines << ";\n";
+	std::cout << "int d2x_bench_vars = " << vars << ";\n";
+	return 0;
+}
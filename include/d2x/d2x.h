@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <ostream>
 
 #include "blocks/block.h"
@@ -26,6 +27,13 @@ namespace rt {
 extern const char string_t_name[];
 using string = builder::name<string_t_name>;
 extern builder::dyn_var<void* (string)> find_stack_var;
+// For resolvers of large values, write the value in pieces and stop once sink_full is true
+extern builder::dyn_var<void (string)> sink_write;
+extern builder::dyn_var<int (void)> sink_full;
+// Resolvers that loop over large structures should check this and return what they have 
+// once it is true. Resolvers still running past their budget are stopped at the next 
+// find_stack_var or sink_write
+extern builder::dyn_var<int (void)> budget_exhausted;
 }
 
 class runtime_value_resolver {
@@ -48,31 +56,80 @@ public:
 };
 
 
+// Interned name, an index into the name table of the context. Names are interned once
+// per context and kept across sections so a DSL compiler can intern its files, functions
+// and vars up front and pass ids to the id overloads, which never allocate after the
+// first occurrence of a name
+typedef int name_id;
+
+// Compact frame recorded for each generated line
+struct source_frame {
+	name_id file;
+	int line;
+	name_id fname;
+	int foffset;
+};
+
 struct value_pair {
-	std::string value;
+	name_id value; // generated expression for the value, the empty name if rvalue is used
 	runtime_value_resolver* rvalue;
 };
 
+struct var_slot {
+	name_id name;
+	value_pair value;
+};
+
 class d2x_context {
 	std::string current_anchor_name;
 	int anchor_counter = 0;	
 	int current_anchor_counter;
 	int current_line_number;	
 
+	// Interned names, names[0] is always the empty name
+	std::vector<std::string> names;
+	std::unordered_map<std::string, name_id> name_index;
+
+	// Tables are flattened across lines. Line i owns [line_begin[i], line_begin[i + 1]) of 
+	// each table, only the last line is ever appended to
+
 	// Source locations 
-	// line->frame->source_loc
-	std::vector<std::vector<source_loc>> source_loc_table;	
+	// line->frame->source_frame
+	std::vector<source_frame> source_frames;
+	std::vector<int> source_line_begin;
 
 	// Identifiers/vars 
-	// line->vname:value_pair
-	std::vector<std::map<std::string, value_pair>> var_table;
+	// line->var_slot
+	std::vector<var_slot> line_vars;
+	std::vector<int> var_line_begin;
+	// name_id->position in line_vars. Only valid if it is within the last line and the 
+	// slot has the same name, so it never has to be reset
+	std::vector<int> var_here_index;
 
-	// scopeid->vname:value_pair
-	std::vector<std::map<std::string, value_pair>> live_vars;
+	// scope->var_slot, scope i owns [scope_begin[i], scope_begin[i + 1])
+	std::vector<var_slot> live_vars;
+	std::vector<int> scope_begin;
 
 	const char* ident_char = "\t";	
 	const char* debug_entry_section = "D2X_entry";
 
+	// Emission options
+	bool emit_hook_points = false;
+	bool emit_line_counters = false;
+	// Whether the current section declared its counter array
+	bool section_has_counters = false;
+	bool emit_history = false;
+	// vname->generated expression for its value, for the current section
+	std::map<name_id, std::string> history_vars;
+
+	bool starts_new_location(void);
+
+	void resize_lines(int);
+	int source_line_end(int line);
+	int var_line_end(int line);
+	var_slot* find_var_here(name_id);
+	void add_var_here(const var_slot&);
+	var_slot* find_live_var(name_id);
 
 public:
 	d2x_context();
@@ -84,27 +141,59 @@ public:
 
 	void nextl(void);
 
-	void push_source_loc(source_loc);
+	name_id intern(const std::string&);
+	const std::string& name_of(name_id) const;
+
+	void push_source_loc(const source_loc&);
+	void push_source_loc(name_id file, int line, name_id fname, int foffset);
 
 	void push_var_scope(void);
 	void pop_var_scope(void);
-	void create_var(std::string);	
-	void delete_var(std::string);
+	void create_var(const std::string&);	
+	void create_var(name_id);	
+	void delete_var(const std::string&);
+	void delete_var(name_id);
 
-	void update_var(std::string, std::string);
-	void update_var(std::string, runtime_value_resolver&);
+	void update_var(const std::string&, const std::string&);
+	void update_var(const std::string&, runtime_value_resolver&);
+	void update_var(name_id, name_id);
+	void update_var(name_id, runtime_value_resolver&);
 
 	void insert_live_vars();
 	
-	void set_var_here(std::string, std::string);
-	void set_var_here(std::string, runtime_value_resolver&);
+	void set_var_here(const std::string&, const std::string&);
+	void set_var_here(const std::string&, runtime_value_resolver&);
+	void set_var_here(name_id, name_id);
+	void set_var_here(name_id, runtime_value_resolver&);
 
+	// Sections emitted into the same translation unit share identical tables and resolvers. 
+	// DSL compilers that write sections to more than one generated file must call 
+	// begin_translation_unit before emitting into each new file
 	void emit_function_info(std::ostream& oss);
+	void begin_translation_unit(void);
+
+	// Emit cheap guarded calls into the runtime at DSL statement boundaries 
+	// for evaluating conditional breakpoints in process
+	void enable_hook_points(bool enable = true);
+	// Emit per DSL line execution counters. Takes effect from the next begin_section
+	void enable_line_counters(bool enable = true);
+	// Record the values of tracked vars at DSL statement boundaries into per thread 
+	// history buffers that can be inspected with xhistory
+	void enable_history(bool enable = true);
+	// Track vname in the history with the generated expression giving its value. Only applies 
+	// to the current section and to lines where vname is live
+	void track_var(const std::string& vname, const std::string& expr);
+	void track_var(name_id vname, const std::string& expr);
+	// Code to be inserted at the beginning of the current generated line
+	// before the statement. Empty if nothing needs to be inserted
+	std::string line_instrumentation(void);
 
 private:
 	// Emit time state and functions only
-	std::vector<std::string> string_table;
-	std::map<std::string, int> reverse_string_table;
+	// Names used by the current section, in the order of their string ids
+	std::vector<name_id> string_table;
+	// name_id->string id in the current section, -1 if not used yet
+	std::vector<int> section_string_ids;
 
 	std::vector<std::tuple<int, int, int, int>> emit_source_list;
 	std::vector<std::pair<int, int>> emit_source_table;
@@ -114,13 +203,105 @@ private:
 
 	// Resolver stuff
 	std::vector<runtime_value_resolver*> used_resolvers;
+	// Resolvers defined so far, and those defined or declared in the current translation unit
 	std::vector<runtime_value_resolver*> emitted_resolvers;
+	std::vector<runtime_value_resolver*> unit_resolvers;
+
+	// Contents of the tables emitted so far (type and body)->array name
+	std::unordered_map<std::string, std::string> emitted_tables;
 
 	// functions
-	int get_string_id(std::string);		
+	int get_string_id(name_id);		
+	std::string emit_table(std::ostream &oss, const std::string &type, const std::string &suffix, 
+		const std::string &body);
+};
+
+/* Compile time selection of D2X. DSL compilers that use d2x_context_t<Policy> and its 
+resolver_t instead of d2x_context and runtime_value_resolver can drop all D2X work from builds 
+with disabled_policy without changing any call sites. The disabled context has the same 
+interface as d2x_context but every call is an empty inline function taking its arguments 
+by reference, so no strings are built and nothing is recorded. The disabled resolver 
+discards its handler without wrapping it, so resolver lambdas are never instantiated or 
+extracted */
+struct enabled_policy {};
+struct disabled_policy {};
+
+template <typename Policy>
+class d2x_context_t;
+
+template <>
+class d2x_context_t<enabled_policy>: public d2x_context {
+public:
+	typedef runtime_value_resolver resolver_t;
 };
 
+class null_value_resolver {
+public:
+	template <typename T>
+	null_value_resolver(const T&) {}
+};
+
+template <>
+class d2x_context_t<disabled_policy> {
+	// Accepts the braced source_loc initializers passed to push_source_loc
+	struct null_source_loc {
+		template <typename... Args>
+		null_source_loc(const Args&...) {}
+	};
+public:
+	typedef null_value_resolver resolver_t;
+
+	void reset_context(void) {}
+
+	std::string begin_section(void) { return std::string(); }
+	void end_section(void) {}
+
+	void nextl(void) {}
+
+	template <typename T>
+	name_id intern(const T&) { return 0; }
+	const std::string& name_of(name_id) const { 
+		static const std::string empty;
+		return empty; 
+	}
+
+	void push_source_loc(const null_source_loc&) {}
+	template <typename... Args>
+	void push_source_loc(const Args&...) {}
+
+	void push_var_scope(void) {}
+	void pop_var_scope(void) {}
+	template <typename T>
+	void create_var(const T&) {}
+	template <typename T>
+	void delete_var(const T&) {}
+	template <typename T, typename V>
+	void update_var(const T&, const V&) {}
+
+	void insert_live_vars() {}
+
+	template <typename T, typename V>
+	void set_var_here(const T&, const V&) {}
 
+	void emit_function_info(std::ostream&) {}
+	void begin_translation_unit(void) {}
+
+	void enable_hook_points(bool = true) {}
+	void enable_line_counters(bool = true) {}
+	void enable_history(bool = true) {}
+	template <typename T, typename E>
+	void track_var(const T&, const E&) {}
+	std::string line_instrumentation(void) { return std::string(); }
+};
+
+// Policy of code that names neither, disabled if D2X_DISABLE is defined
+#ifdef D2X_DISABLE
+typedef disabled_policy default_policy;
+#else
+typedef enabled_policy default_policy;
+#endif
+typedef d2x_context_t<default_policy> default_context;
+typedef default_context::resolver_t default_value_resolver;
 
 }
 
@@ -5,6 +5,7 @@
 #include <libdwarf/dwarf.h>
 #include <sstream>
 #include <fstream>
+#include <vector>
 
 namespace d2x {
 namespace util {
@@ -16,8 +17,24 @@ int find_line_info(uint64_t addr, int* line_no, const char** filename,
 	std::string &function_name, std::string &linkage_name);
 
 int find_debug_info(const char* filename, Dwarf_Debug* ret);
+void release_debug_info(const char* filename);
+// Debug info from an ELF image in memory, for code that is never written to disk
+int find_debug_info_in_memory(const void* image, size_t size, Dwarf_Debug* ret);
+void release_debug_info_in_memory(Dwarf_Debug dbg);
 void reset_cu(Dwarf_Debug dbg);
+// Lookups from the debug index cache of debug info opened with find_debug_info
+bool has_debug_index(Dwarf_Debug dbg);
+// Offset of the DIE of varname in the subprogram containing pc. -1 if there is no such var 
+// or no index
+int find_var_die_offset(Dwarf_Debug dbg, uint64_t pc, const char* varname, Dwarf_Off* ret);
 Dwarf_Die find_cu_die(Dwarf_Debug dbg, uint64_t addr);
+// DW_AT_comp_dir of the CU containing addr, or else of the first CU named cu_name. Empty 
+// if there is no such CU
+std::string find_comp_dir(Dwarf_Debug dbg, uint64_t addr, const char* cu_name);
+// Lexically normalized path. Relative paths are joined to base_dir first unless it is empty
+std::string normalize_path(const std::string &path, const std::string &base_dir);
+// Call sites (file, line) of the inlined subroutines containing addr, innermost first
+void find_inline_call_sites(Dwarf_Debug dbg, uint64_t addr, std::vector<std::pair<const char*, int>> &call_sites);
 
 
 }
@@ -0,0 +1,28 @@
+#ifndef D2X_HEAP_H
+#define D2X_HEAP_H
+// Sampling heap profiler attributing allocations to DSL extended stacks. It replaces the
+// global operator new and delete, so it is a separate library (libd2x_runtime_heap.a) that
+// is only linked into programs that want it, before the core runtime.
+// Sampling is off until D2X_HEAP_PROFILE is set to the mean number of bytes between samples
+// or enable_heap_profiler is called. D2X_HEAP_PROFILE_OUTPUT names a file the report is
+// written to at exit
+#include "d2x_runtime/d2x_runtime_core.h"
+
+namespace d2x {
+namespace runtime {
+
+// Samples on average one allocation every interval bytes, 0 stops sampling. Allocations
+// sampled so far stay tracked until they are freed
+void enable_heap_profiler(size_t interval);
+
+// Estimated live and peak bytes, bytes allocated and allocation counts per DSL extended stack
+std::string get_heap_profile(void);
+
+namespace cmd {
+void xheap(const char* filename);
+}
+
+}
+}
+
+#endif
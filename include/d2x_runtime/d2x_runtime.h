@@ -1,5 +1,6 @@
 #ifndef D2X_RUNTIME_H
 #define D2X_RUNTIME_H
+#include "d2x_runtime/d2x_runtime_core.h"
 #include <iostream>
 #include <vector>
 #include <stdint.h>
@@ -12,65 +13,6 @@
 namespace d2x {
 namespace runtime {
 
-struct d2x_source_stack {
-	int stack_size;
-	int stack_offset;
-};
-struct d2x_source_loc {
-	int filename;
-	int linenumber;
-	int function;
-	int foffset;
-};
-
-struct d2x_var_stack {
-	int stack_size;
-	int stack_offset;
-};
-
-struct d2x_var_entry {
-	int varname;
-	int varvalue;
-	unsigned long long rvarvalue;
-};
-
-struct d2x_function_header {
-	unsigned long long function_addr; // start address of the function for matching
-
-	int source_table_len; // Equal to number of lines in the function
-	struct d2x_source_stack* source_table; // points to 1.a
-
-	int source_list_len;
-	struct d2x_source_loc* source_list; // points to 1.b
-
-	int var_table_len;
-	struct d2x_var_stack* var_table; // points to 2.a
-	
-	int var_list_len;
-	struct d2x_var_entry* var_list; // points to 2.b
-
-	int string_table_len;
-	const char** string_table; // points to 3
-
-	/* scratch space for use at runtime */
-	const char* identified_filename;
-	int identified_line;
-};
-
-extern std::vector<d2x_function_header*> *registered_function_headers;
-static void d2x_headers_init(void) {
-	if (registered_function_headers == nullptr) {
-		registered_function_headers = new std::vector<d2x_function_header*>();
-	}
-}
-
-struct d2x_register_header {
-	d2x_register_header(struct d2x_function_header *h) {
-		d2x_headers_init();
-		registered_function_headers->push_back(h);
-	}	
-};
-
 struct d2x_context {
 	// Register info
 	uint64_t rip;
@@ -101,23 +43,24 @@ std::string get_backtrace(struct d2x_context ctx);
 std::string get_listing(struct d2x_context ctx);
 std::string get_frame(struct d2x_context ctx, const char*);
 std::string get_vars(struct d2x_context ctx, const char*);
+// Renders the bytes [offset, offset + len) of a var's value. Returns the number of bytes 
+// written to buffer, fewer than len once the end is reached, or -1 if the var is not live
+long long get_value_chunk(struct d2x_context ctx, const char* varname, char* buffer, size_t offset, size_t len);
+std::string get_value(struct d2x_context ctx, const char* varname, size_t offset, size_t len);
 std::string get_break(struct d2x_context ctx, const char* source_spec, std::ostream &output_command_file);
-namespace rtv {
-	void* find_stack_var(std::string varname);
-}
-
-
-/* API functions to be invoked from the debugger */
-namespace cmd {
-void xbt(void* ip, void* sp, void* bp, void* bx);
-void xlist(void* ip, void* sp, void* bp, void* bx);
-void xframe(void* ip, void* sp, void* bp, void* bx, const char*);
-void xvars(void* ip, void* sp, void* bp, void* bx, const char*);
-void xfvl(void* ip, void* sp, void* bp, void* bx, const char*);
-const char* xbreak(void* ip, void* sp, void* bp, void* bx, const char* source_spec);
-}
-/* End of API functions */
-
+std::string get_watch(struct d2x_context ctx, const char* varname, std::ostream &output_command_file);
+std::string get_step(struct d2x_context ctx, const char* mode, std::ostream &output_command_file);
+std::string get_cbreak(struct d2x_context ctx, const char* source_spec, const char* condition, std::ostream &output_command_file);
+
+// Lookups behind the commands above, exposed for the benchmark
+// Header and generated line offset of every location that maps to the DSL file and line
+std::vector<std::pair<d2x_function_header*, int>> find_all_breaks(struct d2x_context ctx, std::string spec_filename, int spec_line_no);
+// Address of a native variable live in the frame of ctx, NULL if it is not found
+void* find_var_loc(struct d2x_context ctx, const char* varname, size_t* size = NULL);
+
+const char* get_backtrace_records(struct d2x_context ctx);
+const char* get_vars_records(struct d2x_context ctx);
+const char* get_break_records(void);
 
 
 }
@@ -0,0 +1,236 @@
+#ifndef D2X_RUNTIME_CORE_H
+#define D2X_RUNTIME_CORE_H
+// The part of the runtime included by generated code. It only has the tables, registration,
+// line counters and the debugger entry points, which load the DWARF backend on first use
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+
+namespace d2x {
+namespace runtime {
+
+struct d2x_source_stack {
+	int stack_size;
+	int stack_offset;
+};
+struct d2x_source_loc {
+	int filename;
+	int linenumber;
+	int function;
+	int foffset;
+};
+
+struct d2x_var_stack {
+	int stack_size;
+	int stack_offset;
+};
+
+struct d2x_var_entry {
+	int varname;
+	int varvalue;
+	unsigned long long rvarvalue;
+};
+
+// Section was generated with hook points at DSL statement boundaries
+#define D2X_HEADER_HOOKS 1
+
+// Execution count of a generated line that starts a new DSL location. Padded to a cache line so
+// counters of different lines incremented from parallel regions do not share lines
+struct alignas(64) d2x_line_counter {
+	unsigned long long count;
+};
+static inline void d2x_count_line(struct d2x_line_counter &counter) {
+	__atomic_fetch_add(&counter.count, 1, __ATOMIC_RELAXED);
+}
+
+struct d2x_function_header {
+	unsigned long long function_addr; // start address of the function for matching
+
+	int source_table_len; // Equal to number of lines in the function
+	struct d2x_source_stack* source_table; // points to 1.a
+
+	int source_list_len;
+	struct d2x_source_loc* source_list; // points to 1.b
+
+	int var_table_len;
+	struct d2x_var_stack* var_table; // points to 2.a
+	
+	int var_list_len;
+	struct d2x_var_entry* var_list; // points to 2.b
+
+	int string_table_len;
+	const char** string_table; // points to 3
+
+	int flags; // D2X_HEADER_* bits
+
+	struct d2x_line_counter* counters; // one per line, NULL if not emitted
+
+	/* generated file and line of the section anchor, recorded at compile time */
+	const char* identified_filename;
+	int identified_line;
+};
+
+/* Headers are registered with the registry of the module containing them and 
+unregistered when the module is unloaded */
+void register_header(struct d2x_function_header *h);
+void unregister_header(struct d2x_function_header *h);
+
+struct d2x_register_header {
+	struct d2x_function_header *header;
+	d2x_register_header(struct d2x_function_header *h): header(h) {
+		register_header(h);
+	}	
+	~d2x_register_header() {
+		unregister_header(header);
+	}
+};
+
+/* Code compiled in memory (JIT) is not known to the dynamic loader and has no file to read
+DWARF from, so its range is registered explicitly along with either an in-memory ELF image
+carrying relocated debug info, or a precomputed address to generated line table. Addresses in
+both are relative to load_base. Headers whose constructors ran before their code range was 
+registered are picked up too. The JIT is expected to register unwind info for the code itself */
+struct d2x_line_entry {
+	unsigned long long address;
+	int line; // 0 marks the end of a sequence
+	int file; // index into the files array
+};
+// Return 0 on success and -1 if the image cannot be read or the range overlaps another module
+int register_jit_module(const char* name, const void* load_base, const void* code_begin, const void* code_end, 
+	const void* elf_image, size_t elf_size, struct d2x_function_header** headers, int num_headers);
+int register_jit_line_table(const char* name, const void* load_base, const void* code_begin, const void* code_end, 
+	const struct d2x_line_entry* lines, int num_lines, const char** files, int num_files, 
+	struct d2x_function_header** headers, int num_headers);
+void unregister_jit_module(const void* code_begin);
+
+/* Hook points emitted at DSL statement boundaries. d2x_hooks_enabled is only set 
+while conditional breakpoints exist, otherwise a hook point costs one branch */
+extern volatile int d2x_hooks_enabled;
+void d2x_hook(unsigned long long function_addr, int line);
+
+// Line counters of all sections aggregated by DSL file:line and by extended stack
+std::string get_line_counts(void);
+
+/* History of tracked var values. Generated code records an entry per tracked var at each DSL 
+statement boundary into a ring buffer owned by the recording thread, so recording needs no 
+locks or atomic read-modify-writes. Only the last D2X_HISTORY_SIZE entries are kept and 
+the history of a thread goes away when it exits */
+#define D2X_HISTORY_SIZE 4096
+struct d2x_history_entry {
+	unsigned long long function_addr; // identifies the section
+	int line; // line offset in the section
+	int varname; // index into the section's string table
+	int is_float;
+	union {
+		long long i;
+		double f;
+	} value;
+};
+struct d2x_history_ring {
+	struct d2x_history_entry entries[D2X_HISTORY_SIZE];
+	unsigned long long head; // number of entries ever recorded
+	int thread_index;
+};
+extern thread_local struct d2x_history_ring* d2x_history_thread_ring;
+struct d2x_history_ring* d2x_history_init_thread(void);
+
+template <typename T>
+static inline void d2x_history_value(struct d2x_history_entry &e, T value, std::true_type) {
+	e.is_float = 1;
+	e.value.f = value;
+}
+template <typename T>
+static inline void d2x_history_value(struct d2x_history_entry &e, T value, std::false_type) {
+	e.is_float = 0;
+	e.value.i = (long long) value;
+}
+template <typename T>
+static inline void d2x_record_history(unsigned long long function_addr, int line, int varname, T value) {
+	struct d2x_history_ring* ring = d2x_history_thread_ring;
+	if (__builtin_expect(ring == nullptr, 0))
+		ring = d2x_history_init_thread();
+	unsigned long long head = ring->head;
+	struct d2x_history_entry &e = ring->entries[head % D2X_HISTORY_SIZE];
+	e.function_addr = function_addr;
+	e.line = line;
+	e.varname = varname;
+	d2x_history_value(e, value, typename std::is_floating_point<T>::type());
+	// Publish the entry after it is written for readers on other threads
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+// The last count values of varname recorded by every thread, newest first
+std::string get_history(const char* varname, int count);
+
+/* The backend doing DWARF and libunwind based lookups is a separate shared library loaded 
+by the first debugger command. It is found with D2X_BACKEND_PATH if set, otherwise as 
+libd2x_runtime_backend.so on the library search path. Returns 0 if it is loaded */
+int load_backend(void);
+
+// DSL extended stack at a code address, one "function at file:line" line per frame, innermost 
+// first. Empty if the address is not in a D2X section or the backend is not available
+std::string get_dsl_frames(unsigned long long ip);
+
+/* Serves the DSL extended stacks of all threads of the process on a Unix domain socket 
+for when a debugger cannot be attached. Every connection gets the stacks of all threads 
+as text and is closed. All threads are signalled together, with D2X_INTROSPECT_SIGNAL or 
+SIGRTMIN + 4 by default, and each is only interrupted long enough to unwind its stack. 
+Threads that do not respond before a single deadline are reported as such. The socket is only
+accessible to the owner. Also started when the program starts if D2X_INTROSPECT_SOCKET is 
+set, where %p in the path is replaced by the pid. Returns 0 if the server is running */
+int start_introspection_server(const char* socket_path);
+
+/* Structured results for tools. The returned buffer starts with "D2XR", a uint32 version, the uint32
+size of the buffer and the uint32 number of records. Each record is a uint32 type, the uint32 size 
+of its payload and the payload. Integers are 32 bit and strings are a uint32 length followed by the bytes */
+#define D2X_RECORD_VERSION 1
+// int index, string function, int function offset, string file, int line
+#define D2X_RECORD_FRAME 1
+// string name, string value, int truncated
+#define D2X_RECORD_VAR 2
+// int id, int status (1 enabled, 2 disabled), string file, int line, string condition, int locations
+#define D2X_RECORD_BREAK 3
+
+namespace rtv {
+	void* find_stack_var(std::string varname);
+	// Resolvers for large values write them in pieces, only the window requested is kept
+	void sink_write(std::string value);
+	int sink_full(void);
+	// Non zero once the resolver has used up its time or output budget
+	int budget_exhausted(void);
+}
+
+
+/* API functions to be invoked from the debugger */
+namespace cmd {
+void xbt(void* ip, void* sp, void* bp, void* bx);
+void xlist(void* ip, void* sp, void* bp, void* bx);
+void xframe(void* ip, void* sp, void* bp, void* bx, const char*);
+void xvars(void* ip, void* sp, void* bp, void* bx, const char*);
+void xfvl(void* ip, void* sp, void* bp, void* bx, const char*);
+void xvalue(void* ip, void* sp, void* bp, void* bx, const char* varname, unsigned long long offset, unsigned long long len);
+long long xvalue_chunk(void* ip, void* sp, void* bp, void* bx, const char* varname, char* buffer, 
+	unsigned long long offset, unsigned long long len);
+const char* xbreak(void* ip, void* sp, void* bp, void* bx, const char* source_spec);
+void xbreak_bind(int break_id, int first_bp, int last_bp);
+void xcounts(const char* filename);
+void xhistory(const char* varname, int count);
+// Sets the time (ms) and output (bytes) budgets of resolvers, negative values keep the current 
+// budget and 0 disables it. Prints the budgets in effect
+void xbudget(long long time_ms, long long output_bytes);
+// Same results as structured records, valid until the next such call on the thread
+const char* xbt_records(void* ip, void* sp, void* bp, void* bx);
+const char* xvars_records(void* ip, void* sp, void* bp, void* bx);
+const char* xbreak_records(void);
+const char* xwatch(void* ip, void* sp, void* bp, void* bx, const char* varname);
+// mode is one of "next", "step" or "finish"
+const char* xstep(void* ip, void* sp, void* bp, void* bx, const char* mode);
+const char* xcbreak(void* ip, void* sp, void* bp, void* bx, const char* source_spec, const char* condition);
+const char* xdel(void* ip, void* sp, void* bp, void* bx, const char* source_spec);
+}
+/* End of API functions */
+
+}
+}
+
+#endif
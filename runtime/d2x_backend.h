@@ -0,0 +1,64 @@
+#ifndef D2X_BACKEND_H
+#define D2X_BACKEND_H
+#include "d2x_runtime/d2x_runtime_core.h"
+
+// Interface between the core runtime linked into programs and the backend library it loads.
+// Not part of the public API, both sides are built from the same tree
+namespace d2x {
+namespace runtime {
+
+#define D2X_BACKEND_VERSION 5
+
+struct d2x_core_ops {
+	int version;
+	volatile int* hooks_enabled;
+};
+
+struct d2x_backend_ops {
+	int version;
+
+	void (*register_header)(struct d2x_function_header* h);
+	void (*unregister_header)(struct d2x_function_header* h);
+	int (*register_jit_module)(const char* name, const void* load_base, const void* code_begin, const void* code_end, 
+		const void* elf_image, size_t elf_size, struct d2x_function_header** headers, int num_headers);
+	int (*register_jit_line_table)(const char* name, const void* load_base, const void* code_begin, const void* code_end, 
+		const struct d2x_line_entry* lines, int num_lines, const char** files, int num_files, 
+		struct d2x_function_header** headers, int num_headers);
+	void (*unregister_jit_module)(const void* code_begin);
+	// caller_sp is the stack pointer of the generated code at the call into the core
+	void (*hook)(unsigned long long function_addr, int line, unsigned long long caller_sp);
+
+	void* (*find_stack_var)(std::string varname);
+	void (*sink_write)(std::string value);
+	int (*sink_full)(void);
+	int (*budget_exhausted)(void);
+
+	void (*xbt)(void* ip, void* sp, void* bp, void* bx);
+	void (*xlist)(void* ip, void* sp, void* bp, void* bx);
+	void (*xframe)(void* ip, void* sp, void* bp, void* bx, const char*);
+	void (*xvars)(void* ip, void* sp, void* bp, void* bx, const char*);
+	void (*xfvl)(void* ip, void* sp, void* bp, void* bx, const char*);
+	void (*xvalue)(void* ip, void* sp, void* bp, void* bx, const char* varname, unsigned long long offset, unsigned long long len);
+	long long (*xvalue_chunk)(void* ip, void* sp, void* bp, void* bx, const char* varname, char* buffer, 
+		unsigned long long offset, unsigned long long len);
+	const char* (*xbreak)(void* ip, void* sp, void* bp, void* bx, const char* source_spec);
+	void (*xbreak_bind)(int break_id, int first_bp, int last_bp);
+	const char* (*xbt_records)(void* ip, void* sp, void* bp, void* bx);
+	const char* (*xvars_records)(void* ip, void* sp, void* bp, void* bx);
+	const char* (*xbreak_records)(void);
+	const char* (*xwatch)(void* ip, void* sp, void* bp, void* bx, const char* varname);
+	const char* (*xstep)(void* ip, void* sp, void* bp, void* bx, const char* mode);
+	const char* (*xcbreak)(void* ip, void* sp, void* bp, void* bx, const char* source_spec, const char* condition);
+	const char* (*xdel)(void* ip, void* sp, void* bp, void* bx, const char* source_spec);
+	void (*xbudget)(long long time_ms, long long output_bytes);
+	int (*start_introspection_server)(const char* socket_path);
+	std::string (*dsl_frames)(unsigned long long ip);
+};
+
+}
+}
+
+// Exported by the backend library, called once by the core when it is loaded
+extern "C" const struct d2x::runtime::d2x_backend_ops* d2x_backend_init(const struct d2x::runtime::d2x_core_ops* core);
+
+#endif
@@ -0,0 +1,312 @@
+#include "d2x_runtime/d2x_heap.h"
+#include <execinfo.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <new>
+#include <map>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+/* Allocations are sampled by bytes: each thread counts down a random number of bytes with
+mean interval and the allocation that crosses zero is sampled, so large allocations are
+sampled more often. A sample of size s stands for s / (1 - exp(-s / interval)) bytes.
+The native stack of a sample is captured with backtrace and only mapped to DSL frames when
+a report is made. Sampled pointers are kept in a fixed lock free table, so frees only pay
+for a lookup while sampled allocations are live */
+
+namespace d2x {
+namespace runtime {
+
+#define D2X_HEAP_MAX_FRAMES 32
+#define D2X_HEAP_TABLE_SIZE (1 << 16)
+// Slots probed for a pointer, one cache line of the pointer table
+#define D2X_HEAP_TABLE_WAYS 8
+
+struct d2x_heap_stack {
+	std::vector<uint64_t> ips;
+	long long live_bytes = 0;
+	long long peak_bytes = 0;
+	unsigned long long alloc_bytes = 0;
+	unsigned long long allocs = 0;
+};
+
+struct d2x_heap_sample {
+	size_t weight;
+	int stack;
+};
+
+static std::atomic<size_t> heap_interval(0);
+static std::atomic<long long> heap_live_samples(0);
+static std::atomic<uintptr_t> heap_table_ptrs[D2X_HEAP_TABLE_SIZE];
+static struct d2x_heap_sample heap_table_samples[D2X_HEAP_TABLE_SIZE];
+
+// Allocated on first use and never freed, allocations can outlive static destructors
+static std::mutex* heap_mutex = nullptr;
+static std::vector<struct d2x_heap_stack>* heap_stacks = nullptr;
+static std::unordered_map<std::string, int>* heap_stack_index = nullptr;
+static long long heap_live_bytes = 0;
+static long long heap_peak_bytes = 0;
+// Samples that found no free slot in the pointer table
+static unsigned long long heap_dropped_samples = 0;
+static unsigned long long heap_dropped_bytes = 0;
+static std::once_flag heap_init_flag;
+
+struct d2x_heap_thread_state {
+	long long bytes_until_sample = -1;
+	uint64_t random_state = 0;
+	// Set while the profiler itself runs so its own allocations are not sampled
+	bool in_profiler = false;
+};
+static thread_local struct d2x_heap_thread_state heap_thread_state;
+
+static void heap_init(void) {
+	heap_mutex = new std::mutex();
+	heap_stacks = new std::vector<struct d2x_heap_stack>();
+	heap_stack_index = new std::unordered_map<std::string, int>();
+}
+
+static size_t next_sample_distance(struct d2x_heap_thread_state &ts, size_t interval) {
+	if (ts.random_state == 0)
+		ts.random_state = (uint64_t) &ts ^ ((uint64_t) getpid() << 32) ^ 0x9e3779b97f4a7c15ULL;
+	// xorshift64
+	ts.random_state ^= ts.random_state << 13;
+	ts.random_state ^= ts.random_state >> 7;
+	ts.random_state ^= ts.random_state << 17;
+	double u = ((ts.random_state >> 11) + 1) * (1.0 / 9007199254740993.0);
+	return (size_t) (-log(u) * interval) + 1;
+}
+
+static size_t table_group(const void* p) {
+	uint64_t h = (uint64_t) p * 0x9e3779b97f4a7c15ULL;
+	return (h >> 40) % (D2X_HEAP_TABLE_SIZE / D2X_HEAP_TABLE_WAYS) * D2X_HEAP_TABLE_WAYS;
+}
+
+static void __attribute__((noinline)) record_sample(void* p, size_t size, size_t interval) {
+	struct d2x_heap_thread_state &ts = heap_thread_state;
+	ts.in_profiler = true;
+	std::call_once(heap_init_flag, heap_init);
+
+	void* frames[D2X_HEAP_MAX_FRAMES + 2];
+	int n = backtrace(frames, D2X_HEAP_MAX_FRAMES + 2);
+	// Drop this function and operator new
+	std::string key;
+	std::vector<uint64_t> ips;
+	for (int i = 2; i < n; i++) {
+		ips.push_back((uint64_t) frames[i]);
+		key.append((const char*) &frames[i], sizeof(void*));
+	}
+	// Allocations of any size may be skipped, large ones just rarely. Sizes of 0 are never sampled
+	size_t weight = size == 0 ? 0 : (size_t) (size / -expm1(-(double) size / interval));
+
+	// Find a free slot for the pointer. Without one the sample still counts as allocated, but 
+	// its free could not be matched, so it is left out of live and peak and reported as dropped
+	size_t group = table_group(p);
+	int slot = -1;
+	for (int w = 0; w < D2X_HEAP_TABLE_WAYS; w++) {
+		uintptr_t expected = 0;
+		if (heap_table_ptrs[group + w].compare_exchange_strong(expected, (uintptr_t) p)) {
+			slot = group + w;
+			break;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(*heap_mutex);
+		auto it = heap_stack_index->find(key);
+		int stack;
+		if (it == heap_stack_index->end()) {
+			stack = heap_stacks->size();
+			heap_stacks->push_back(d2x_heap_stack());
+			heap_stacks->back().ips = ips;
+			(*heap_stack_index)[key] = stack;
+		} else
+			stack = it->second;
+		struct d2x_heap_stack &s = (*heap_stacks)[stack];
+		s.alloc_bytes += weight;
+		s.allocs++;
+		if (slot == -1) {
+			heap_dropped_samples++;
+			heap_dropped_bytes += weight;
+		} else {
+			s.live_bytes += weight;
+			s.peak_bytes = std::max(s.peak_bytes, s.live_bytes);
+			heap_live_bytes += weight;
+			heap_peak_bytes = std::max(heap_peak_bytes, heap_live_bytes);
+			heap_table_samples[slot].weight = weight;
+			heap_table_samples[slot].stack = stack;
+			heap_live_samples++;
+		}
+	}
+	ts.in_profiler = false;
+}
+
+static void untrack(void* p) {
+	size_t group = table_group(p);
+	for (int w = 0; w < D2X_HEAP_TABLE_WAYS; w++) {
+		if (heap_table_ptrs[group + w].load(std::memory_order_relaxed) != (uintptr_t) p)
+			continue;
+		std::lock_guard<std::mutex> lock(*heap_mutex);
+		struct d2x_heap_sample sample = heap_table_samples[group + w];
+		heap_table_ptrs[group + w].store(0, std::memory_order_release);
+		(*heap_stacks)[sample.stack].live_bytes -= sample.weight;
+		heap_live_bytes -= sample.weight;
+		heap_live_samples--;
+		return;
+	}
+}
+
+static void* heap_alloc(size_t size) {
+	if (size == 0)
+		size = 1;
+	void* p;
+	while ((p = malloc(size)) == nullptr) {
+		std::new_handler handler = std::get_new_handler();
+		if (handler == nullptr)
+			throw std::bad_alloc();
+		handler();
+	}
+	size_t interval = heap_interval.load(std::memory_order_relaxed);
+	if (__builtin_expect(interval != 0, 0)) {
+		struct d2x_heap_thread_state &ts = heap_thread_state;
+		if (!ts.in_profiler) {
+			if (ts.bytes_until_sample < 0)
+				ts.bytes_until_sample = next_sample_distance(ts, interval);
+			ts.bytes_until_sample -= size;
+			if (ts.bytes_until_sample < 0) {
+				ts.bytes_until_sample = next_sample_distance(ts, interval);
+				record_sample(p, size, interval);
+			}
+		}
+	}
+	return p;
+}
+
+static void heap_free(void* p) {
+	if (p == nullptr)
+		return;
+	if (__builtin_expect(heap_live_samples.load(std::memory_order_relaxed) != 0, 0))
+		untrack(p);
+	free(p);
+}
+
+void enable_heap_profiler(size_t interval) {
+	heap_interval = interval;
+}
+
+std::string get_heap_profile(void) {
+	struct d2x_heap_thread_state &ts = heap_thread_state;
+	bool was_in_profiler = ts.in_profiler;
+	ts.in_profiler = true;
+	std::call_once(heap_init_flag, heap_init);
+	std::vector<struct d2x_heap_stack> stacks;
+	long long live, peak;
+	unsigned long long dropped_samples, dropped_bytes;
+	{
+		std::lock_guard<std::mutex> lock(*heap_mutex);
+		stacks = *heap_stacks;
+		live = heap_live_bytes;
+		peak = heap_peak_bytes;
+		dropped_samples = heap_dropped_samples;
+		dropped_bytes = heap_dropped_bytes;
+	}
+	ts.in_profiler = was_in_profiler;
+
+	// Merge native stacks with the same DSL extended stack. Their peaks may not coincide so
+	// the sum is an upper bound
+	std::map<std::string, struct d2x_heap_stack> dsl_stacks;
+	std::map<uint64_t, std::string> ip_frames;
+	bool have_backend = load_backend() == 0;
+	for (auto &s: stacks) {
+		std::string dsl;
+		for (int i = 0; have_backend && i < (int) s.ips.size(); i++) {
+			// Return addresses point after the call
+			uint64_t ip = s.ips[i] - 1;
+			auto it = ip_frames.find(ip);
+			if (it == ip_frames.end())
+				it = ip_frames.insert(std::make_pair(ip, get_dsl_frames(ip))).first;
+			dsl += it->second;
+		}
+		if (dsl == "")
+			dsl = "(no DSL frames)\n";
+		struct d2x_heap_stack &d = dsl_stacks[dsl];
+		d.live_bytes += s.live_bytes;
+		d.peak_bytes += s.peak_bytes;
+		d.alloc_bytes += s.alloc_bytes;
+		d.allocs += s.allocs;
+	}
+	std::vector<std::pair<std::string, struct d2x_heap_stack>> order(dsl_stacks.begin(), dsl_stacks.end());
+	std::sort(order.begin(), order.end(), [](const std::pair<std::string, struct d2x_heap_stack> &a,
+			const std::pair<std::string, struct d2x_heap_stack> &b) {
+		if (a.second.live_bytes != b.second.live_bytes)
+			return a.second.live_bytes > b.second.live_bytes;
+		return a.second.alloc_bytes > b.second.alloc_bytes;
+	});
+
+	std::stringstream oss;
+	oss << "D2X heap profile, sampling every " << heap_interval.load() << " bytes on average\n";
+	oss << "Live " << live << " bytes, peak " << peak << " bytes (estimated)\n";
+	if (dropped_samples != 0)
+		oss << "Live and peak leave out " << dropped_samples << " samples (" << dropped_bytes 
+			<< " bytes) that did not fit in the pointer table\n";
+	for (auto &o: order) {
+		oss << "live " << o.second.live_bytes << " peak " << o.second.peak_bytes << " allocated "
+			<< o.second.alloc_bytes << " in " << o.second.allocs << " samples\n";
+		std::stringstream frames(o.first);
+		std::string frame;
+		int index = 0;
+		while (std::getline(frames, frame))
+			oss << "\t#" << index++ << " in " << frame << "\n";
+	}
+	return oss.str();
+}
+
+namespace cmd {
+void xheap(const char* filename) {
+	std::string profile = get_heap_profile();
+	if (filename == nullptr || strcmp(filename, "") == 0) {
+		std::cout << profile;
+		return;
+	}
+	std::ofstream output_file(filename);
+	output_file << profile;
+}
+}
+
+// Starts sampling if D2X_HEAP_PROFILE is set and writes the report at exit if
+// D2X_HEAP_PROFILE_OUTPUT is set
+struct d2x_heap_profile_at_start {
+	d2x_heap_profile_at_start() {
+		const char* interval = getenv("D2X_HEAP_PROFILE");
+		if (interval != nullptr)
+			enable_heap_profiler(strtoull(interval, nullptr, 10));
+	}
+	~d2x_heap_profile_at_start() {
+		const char* filename = getenv("D2X_HEAP_PROFILE_OUTPUT");
+		if (filename != nullptr && heap_interval != 0)
+			cmd::xheap(filename);
+	}
+};
+static struct d2x_heap_profile_at_start heap_profile_at_start;
+
+}
+}
+
+void* operator new(std::size_t size) {
+	return d2x::runtime::heap_alloc(size);
+}
+void* operator new[](std::size_t size) {
+	return d2x::runtime::heap_alloc(size);
+}
+void operator delete(void* p) noexcept {
+	d2x::runtime::heap_free(p);
+}
+void operator delete[](void* p) noexcept {
+	d2x::runtime::heap_free(p);
+}
@@ -1,13 +1,28 @@
 #include "d2x_runtime/d2x_runtime.h"
+#include "d2x_backend.h"
 #include "d2x/utils.h"
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <map>
 #include <libdwarf/libdwarf.h>
 #include <libdwarf/dwarf.h>
 #include <sstream>
 #include <fstream>
 #include <algorithm>
+#include <list>
+#include <unordered_map>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
 #define UNW_LOCAL_ONLY
 #include <libunwind.h>
 
@@ -15,94 +30,674 @@
 namespace d2x {
 namespace runtime {
 
-std::vector<d2x_function_header*> *registered_function_headers = nullptr;
+static int config_list_offset = 2;
+static size_t config_context_cache_size = 4096;
+// Values longer than this are truncated when printed with xvars
+static size_t config_value_summary_len = 1024;
+// A resolver running longer or producing more output than this is stopped and its value is 
+// cut short with a marker. 0 disables the budget. Changed with xbudget
+static unsigned long long config_resolver_time_budget_ms = 2000;
+static unsigned long long config_resolver_output_budget = 16 << 20;
+
+// A small LRU map used to cache per-PC lookups. Not thread safe by itself,
+// callers are expected to hold a lock around all accesses.
+template <typename K, typename V>
+class lru_cache {
+	typedef std::list<std::pair<K, V>> list_t;
+	list_t entries;
+	std::unordered_map<K, typename list_t::iterator> index;
+	size_t capacity;
+public:
+	lru_cache(size_t capacity): capacity(capacity) {}
+
+	bool get(const K& key, V& value) {
+		auto it = index.find(key);
+		if (it == index.end())
+			return false;
+		// Move the entry to the front so it is evicted last
+		entries.splice(entries.begin(), entries, it->second);
+		value = it->second->second;
+		return true;
+	}
 
+	void put(const K& key, const V& value) {
+		auto it = index.find(key);
+		if (it != index.end()) {
+			it->second->second = value;
+			entries.splice(entries.begin(), entries, it->second);
+			return;
+		}
+		entries.push_front(std::make_pair(key, value));
+		index[key] = entries.begin();
+		if (entries.size() > capacity) {
+			index.erase(entries.back().first);
+			entries.pop_back();
+		}
+	}
 
-static void* last_ip = NULL;
-static void* last_sp = NULL;
-static struct d2x_context last_ctx;
-static int current_frame_index = 0;
-static int config_list_offset = 2;
+	void clear(void) {
+		entries.clear();
+		index.clear();
+	}
+};
+
+// The DWARF part of a context (module, generated line, matching header) only depends on the IP.
+// This cache is shared by all threads so inspecting many threads stopped at the same PC costs
+// a single lookup. Contexts without a header are only valid until the next registration, 
+// the code at the PC may be registered later, e.g. by a JIT
+struct d2x_cached_context {
+	struct d2x_context ctx;
+	uint64_t registrations;
+};
+static lru_cache<uint64_t, struct d2x_cached_context> pc_context_cache(config_context_cache_size);
+static std::mutex pc_context_mutex;
+static uint64_t pc_context_generation = 0;
+
+// Set once the core runtime has loaded this backend
+static const struct d2x_core_ops* core = nullptr;
+
+static void set_hooks_enabled(int enabled) {
+	if (core != nullptr)
+		*core->hooks_enabled = enabled;
+}
 
-struct d2x_context find_context(void* ip, void* sp, void* bp, void* bx) {
-	if (last_ip == ip && last_sp == sp) 
-		return last_ctx;
-	else {
-		current_frame_index = 0;		
+// libdwarf handles are not thread safe
+static std::mutex dwarf_mutex;
+
+// Window of a value being rendered into a caller provided buffer. Only the bytes in 
+// [offset, offset + len) are stored, everything before and after is just counted
+struct d2x_value_sink {
+	char* buffer;
+	size_t offset;
+	size_t len;
+	size_t written = 0;
+	size_t stored = 0;
+};
+
+static void sink_append(struct d2x_value_sink &sink, const char* data, size_t size) {
+	size_t begin = sink.written;
+	sink.written += size;
+	size_t from = std::max(begin, sink.offset);
+	size_t to = std::min(sink.written, sink.offset + sink.len);
+	if (from >= to)
+		return;
+	memcpy(sink.buffer + (from - sink.offset), data + (from - begin), to - from);
+	sink.stored = to - sink.offset;
+}
+
+// The window is full once a byte past it has been seen, so the caller knows more is left
+static bool sink_full(struct d2x_value_sink &sink) {
+	return sink.written > sink.offset + sink.len;
+}
+
+// State that depends on the thread the debugger is currently inspecting
+struct d2x_thread_state {
+	void* last_ip = NULL;
+	void* last_sp = NULL;
+	struct d2x_context last_ctx;
+	uint64_t last_generation = 0;
+	uint64_t last_registrations = 0;
+	int current_frame_index = 0;
+	struct d2x_context* active_frame_ctx = nullptr;
+	struct d2x_value_sink* active_sink = nullptr;
+	// Budget of the resolver rendering into active_sink
+	std::chrono::steady_clock::time_point resolver_deadline;
+	int resolver_stop = 0;
+};
+static thread_local struct d2x_thread_state thread_state;
+
+// Each loaded module (executable or shared object) has its own registry of headers, indexed 
+// by generated file and anchor line. Lookups for an address only consider the module containing it.
+// The index is keyed by the normalized path of the compile time __FILE__ in the header, joined 
+// with the compilation directory of its CU if it is relative, so it matches the paths of the 
+// line tables exactly. It is rebuilt on the first lookup after headers change, the path of a 
+// header is only resolved once. A module's registry goes away with its last header 
+// when it is dlclose'd. All of this is allocated on first use and never freed since registration 
+// runs from static constructors and destructors
+typedef std::map<int, d2x_function_header*> header_line_index_t;
+struct d2x_module {
+	uint64_t base;
+	uint64_t load_offset;
+	std::string filename;
+	std::vector<d2x_function_header*> headers;
+	std::map<std::string, header_line_index_t> file_index;
+	bool file_index_stale = true;
+	std::unordered_map<d2x_function_header*, std::string> header_paths;
+
+	// JIT modules cover [base, end) and live until they are explicitly unregistered. Lines come from jit_dbg if an ELF image was given, 
+	// otherwise from the sorted line_table
+	bool jit = false;
+	uint64_t end = 0;
+	Dwarf_Debug jit_dbg = nullptr;
+	std::vector<struct d2x_line_entry> line_table;
+	std::vector<std::string> files;
+};
+static std::map<uint64_t, struct d2x_module*> *modules = nullptr;
+// JIT modules by start address, subset of modules
+static std::map<uint64_t, struct d2x_module*> *jit_modules = nullptr;
+// Headers of JIT code whose constructors ran before the code range was registered
+static std::vector<d2x_function_header*> *pending_jit_headers = nullptr;
+static std::unordered_map<d2x_function_header*, struct d2x_module*> *header_modules = nullptr;
+// Files of unloaded modules whose debug info should be reloaded if they come back
+static std::set<std::string> *unloaded_module_files = nullptr;
+static std::mutex registry_mutex;
+
+// Bumped on every registration change, used to rebuild indices over all headers
+static std::atomic<uint64_t> registry_generation(0);
+// Bumped when headers are unregistered, caches holding header pointers must be dropped
+static std::atomic<uint64_t> registry_removals(0);
+
+// Should be called with the registry_mutex held
+static void registry_init(void) {
+	if (modules == nullptr) {
+		modules = new std::map<uint64_t, struct d2x_module*>();
+		header_modules = new std::unordered_map<d2x_function_header*, struct d2x_module*>();
+		unloaded_module_files = new std::set<std::string>();
+		jit_modules = new std::map<uint64_t, struct d2x_module*>();
+		pending_jit_headers = new std::vector<d2x_function_header*>();
 	}
+}
 
-	last_ip = ip;
-	last_sp = sp;
+// Should be called with the registry_mutex held
+static void add_module_header(struct d2x_module* module, d2x_function_header* h) {
+	module->headers.push_back(h);
+	(*header_modules)[h] = module;
+	module->file_index_stale = true;
+}
 
-	d2x_headers_init();
+// Should be called with the registry_mutex held
+static struct d2x_module* find_jit_module(uint64_t addr) {
+	auto it = jit_modules->upper_bound(addr);
+	if (it == jit_modules->begin())
+		return nullptr;
+	--it;
+	if (addr >= it->second->end)
+		return nullptr;
+	return it->second;
+}
 
-	struct d2x_context &ctx = last_ctx;
+static void add_header(struct d2x_function_header *h) {
+	Dl_info info;
+	struct link_map *map = nullptr;
+	if (!dladdr1((void*)h->function_addr, &info, (void**)&map, RTLD_DL_LINKMAP)) {
+		// Not loaded by the dynamic loader, this must be JIT code
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		registry_init();
+		struct d2x_module* module = find_jit_module(h->function_addr);
+		if (module == nullptr) {
+			pending_jit_headers->push_back(h);
+			return;
+		}
+		if (header_modules->find(h) == header_modules->end()) {
+			add_module_header(module, h);
+			registry_generation++;
+		}
+		return;
+	}
 
-	ctx.rip = (uint64_t) ip;
-	ctx.rsp = (uint64_t) sp;
-	ctx.rbp = (uint64_t) bp;
-	ctx.rbx = (uint64_t) bx;
-	
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	registry_init();
+	uint64_t base = (uint64_t) info.dli_fbase;
+	struct d2x_module* &module = (*modules)[base];
+	if (module == nullptr) {
+		module = new struct d2x_module();
+		module->base = base;
+		module->load_offset = (uint64_t) map->l_addr;
+		module->filename = info.dli_fname;
+		// A module loaded again from the same path might have been rebuilt
+		if (unloaded_module_files->erase(module->filename)) {
+			std::lock_guard<std::mutex> dwarf_lock(dwarf_mutex);
+			util::release_debug_info(module->filename.c_str());
+		}
+	}
+	add_module_header(module, h);
+	registry_generation++;
+}
+
+static void remove_header(struct d2x_function_header *h) {
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	registry_init();
+	pending_jit_headers->erase(std::remove(pending_jit_headers->begin(), pending_jit_headers->end(), h), 
+		pending_jit_headers->end());
+	auto it = header_modules->find(h);
+	if (it == header_modules->end())
+		return;
+	struct d2x_module* module = it->second;
+	header_modules->erase(it);
+
+	module->headers.erase(std::remove(module->headers.begin(), module->headers.end(), h), module->headers.end());
+	module->header_paths.erase(h);
+	module->file_index_stale = true;
+	if (module->headers.empty() && !module->jit) {
+		unloaded_module_files->insert(module->filename);
+		modules->erase(module->base);
+		delete module;
+	}
+	registry_generation++;
+	registry_removals++;
+}
+
+static struct d2x_module* create_jit_module(const char* name, const void* load_base, const void* code_begin, 
+		const void* code_end, struct d2x_function_header** headers, int num_headers) {
+	// Same interval test as the core, a new range must not intersect any existing one
+	uint64_t begin = (uint64_t) code_begin, end = (uint64_t) code_end;
+	if (begin >= end || modules->find(begin) != modules->end())
+		return nullptr;
+	auto next = jit_modules->lower_bound(begin);
+	if (next != jit_modules->end() && next->second->base < end)
+		return nullptr;
+	if (next != jit_modules->begin() && std::prev(next)->second->end > begin)
+		return nullptr;
+	struct d2x_module* module = new struct d2x_module();
+	module->base = (uint64_t) code_begin;
+	module->end = (uint64_t) code_end;
+	module->load_offset = (uint64_t) load_base;
+	module->filename = name;
+	module->jit = true;
+	for (int i = 0; i < num_headers; i++) {
+		if (header_modules->find(headers[i]) == header_modules->end())
+			add_module_header(module, headers[i]);
+	}
+	// Adopt headers that were registered before the code range was known
+	auto pending = pending_jit_headers->begin();
+	while (pending != pending_jit_headers->end()) {
+		uint64_t addr = (*pending)->function_addr;
+		if (addr >= module->base && addr < module->end) {
+			if (header_modules->find(*pending) == header_modules->end())
+				add_module_header(module, *pending);
+			pending = pending_jit_headers->erase(pending);
+		} else 
+			++pending;
+	}
+	(*modules)[module->base] = module;
+	(*jit_modules)[module->base] = module;
+	registry_generation++;
+	return module;
+}
+
+static int add_jit_elf_module(const char* name, const void* load_base, const void* code_begin, const void* code_end, 
+		const void* elf_image, size_t elf_size, struct d2x_function_header** headers, int num_headers) {
+	Dwarf_Debug dbg;
+	{
+		std::lock_guard<std::mutex> dwarf_lock(dwarf_mutex);
+		if (util::find_debug_info_in_memory(elf_image, elf_size, &dbg))
+			return -1;
+	}
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	registry_init();
+	struct d2x_module* module = create_jit_module(name, load_base, code_begin, code_end, headers, num_headers);
+	if (module == nullptr) {
+		std::lock_guard<std::mutex> dwarf_lock(dwarf_mutex);
+		util::release_debug_info_in_memory(dbg);
+		return -1;
+	}
+	module->jit_dbg = dbg;
+	return 0;
+}
+
+static int add_jit_line_table_module(const char* name, const void* load_base, const void* code_begin, const void* code_end, 
+		const struct d2x_line_entry* lines, int num_lines, const char** files, int num_files, 
+		struct d2x_function_header** headers, int num_headers) {
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	registry_init();
+	struct d2x_module* module = create_jit_module(name, load_base, code_begin, code_end, headers, num_headers);
+	if (module == nullptr)
+		return -1;
+	module->line_table.assign(lines, lines + num_lines);
+	std::stable_sort(module->line_table.begin(), module->line_table.end(), 
+		[](const struct d2x_line_entry &a, const struct d2x_line_entry &b) { return a.address < b.address; });
+	module->files.assign(files, files + num_files);
+	return 0;
+}
+
+static void remove_jit_module(const void* code_begin) {
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	registry_init();
+	auto it = jit_modules->find((uint64_t) code_begin);
+	if (it == jit_modules->end())
+		return;
+	struct d2x_module* module = it->second;
+	jit_modules->erase(it);
+	modules->erase(module->base);
+	for (auto h: module->headers) 
+		header_modules->erase(h);
+	if (module->jit_dbg != nullptr) {
+		std::lock_guard<std::mutex> dwarf_lock(dwarf_mutex);
+		util::release_debug_info_in_memory(module->jit_dbg);
+	}
+	delete module;
+	registry_generation++;
+	registry_removals++;
+}
+
+// Snapshot of all currently registered headers
+static std::vector<d2x_function_header*> all_headers(void) {
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	registry_init();
+	std::vector<d2x_function_header*> headers;
+	for (auto &module: *modules)
+		headers.insert(headers.end(), module.second->headers.begin(), module.second->headers.end());
+	return headers;
+}
+
+static bool is_registered(d2x_function_header* h) {
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	registry_init();
+	return header_modules->find(h) != header_modules->end();
+}
+
+// __FILE__ is the path as passed to the compiler, relative ones are resolved against the 
+// compilation directory of the CU of the anchor. Should be called with the registry_mutex held
+static void build_file_index(struct d2x_module* module, Dwarf_Debug dbg) {
+	if (!module->file_index_stale)
+		return;
+	module->file_index.clear();
+	for (auto h: module->headers) {
+		if (h->identified_filename == NULL || h->identified_line == -1)
+			continue;
+		auto path = module->header_paths.find(h);
+		if (path == module->header_paths.end()) {
+			std::string comp_dir;
+			if (h->identified_filename[0] != '/' && dbg != nullptr) {
+				std::lock_guard<std::mutex> dwarf_lock(dwarf_mutex);
+				comp_dir = util::find_comp_dir(dbg, h->function_addr - module->load_offset, h->identified_filename);
+			}
+			path = module->header_paths.insert(std::make_pair(h, 
+				util::normalize_path(h->identified_filename, comp_dir))).first;
+		}
+		module->file_index[path->second][h->identified_line] = h;
+	}
+	module->file_index_stale = false;
+}
+
+// Should be called with the registry_mutex held
+static d2x_function_header* find_module_header(struct d2x_module* module, Dwarf_Debug dbg, const char* filename, int line) {
+	build_file_index(module, dbg);
+	auto file = module->file_index.find(util::normalize_path(filename, ""));
+	if (file == module->file_index.end())
+		return nullptr;
+	// The last section whose anchor is at or before line
+	auto it = file->second.upper_bound(line);
+	if (it == file->second.begin())
+		return nullptr;
+	--it;
+	d2x_function_header* header = it->second;
+	if (header->identified_line + header->source_table_len > line)
+		return header;
+	return nullptr;
+}
+
+// In optimized code the line at an IP may be in a function inlined into a generated section, 
+// the section is then found at one of the call sites the IP was inlined through. On a match 
+// the location of ctx is moved to that call site. Should be called with the registry_mutex held
+static d2x_function_header* find_inlined_header(struct d2x_module* module, Dwarf_Debug dbg, uint64_t adjusted_ip, 
+		struct d2x_context &ctx) {
+	if (module->headers.empty())
+		return nullptr;
+	std::vector<std::pair<const char*, int>> call_sites;
+	{
+		std::lock_guard<std::mutex> dwarf_lock(dwarf_mutex);
+		util::find_inline_call_sites(dbg, adjusted_ip, call_sites);
+	}
+	for (auto &site: call_sites) {
+		d2x_function_header* header = find_module_header(module, dbg, site.first, site.second);
+		if (header != nullptr) {
+			ctx.src_filename = site.first;
+			ctx.address_line = site.second;
+			return header;
+		}
+	}
+	return nullptr;
+}
+
+static d2x_function_header* find_header(uint64_t module_base, Dwarf_Debug dbg, uint64_t adjusted_ip, struct d2x_context &ctx) {
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	registry_init();
+	auto module = modules->find(module_base);
+	if (module == modules->end())
+		return nullptr;
+	d2x_function_header* header = find_module_header(module->second, dbg, ctx.src_filename, ctx.address_line);
+	if (header == nullptr)
+		header = find_inlined_header(module->second, dbg, adjusted_ip, ctx);
+	return header;
+}
+
+// Locates IPs in registered JIT code. Returns false if the IP is not in any JIT module
+static bool find_jit_location(struct d2x_context &ctx) {
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	registry_init();
+	struct d2x_module* module = find_jit_module(ctx.rip);
+	if (module == nullptr)
+		return false;
+	ctx.dli_fname = module->filename.c_str();
+	ctx.load_offset = module->load_offset;
+	uint64_t adjusted_ip = ctx.rip - ctx.load_offset;
 
+	if (module->jit_dbg != nullptr) {
+		std::lock_guard<std::mutex> dwarf_lock(dwarf_mutex);
+		ctx.dbg = module->jit_dbg;
+		int line_no = -1;
+		const char* fname = NULL;
+		std::string func_name, linkage_name;	
+		util::find_line_info_with_dbg(ctx.dbg, adjusted_ip, &line_no, &fname, func_name, linkage_name);
+		ctx.address_line = line_no;	
+		ctx.src_filename = fname;
+	} else {
+		// The last entry at or before the IP, entries with line 0 end a sequence
+		auto entry = std::upper_bound(module->line_table.begin(), module->line_table.end(), adjusted_ip, 
+			[](uint64_t addr, const struct d2x_line_entry &e) { return addr < e.address; });
+		if (entry != module->line_table.begin()) {
+			--entry;
+			if (entry->line > 0 && entry->file >= 0 && entry->file < (int) module->files.size()) {
+				ctx.address_line = entry->line;
+				ctx.src_filename = module->files[entry->file].c_str();
+			}
+		}
+	}
+
+	if (ctx.address_line == -1)
+		return true;
+	d2x_function_header* header = find_module_header(module, module->jit_dbg, ctx.src_filename, ctx.address_line);
+	if (header == nullptr && module->jit_dbg != nullptr)
+		header = find_inlined_header(module, module->jit_dbg, adjusted_ip, ctx);
+	if (header != nullptr) {
+		ctx.header = header;
+		ctx.function_line = header->identified_line;
+	}
+	return true;
+}
+
+static void find_location(struct d2x_context &ctx) {
 	ctx.function = 0;
 	ctx.header = nullptr;
 	ctx.dli_fname = nullptr;
 	ctx.load_offset = 0;	
 	ctx.address_line = -1;	
 	ctx.function_line = -1;	
+	ctx.src_filename = nullptr;
+	ctx.dbg = nullptr;
+	ctx.cu = nullptr;
+
+	// JIT code is not known to the dynamic loader and has no file on disk
+	if (find_jit_location(ctx))
+		return;
+
 	// First we will identify the function this IP belongs to
 	Dl_info info;
 	struct link_map *map = nullptr;
-	if (!dladdr1((void*) ip, &info, (void**)&map, RTLD_DL_LINKMAP)) {
-		return ctx;
+	if (!dladdr1((void*) ctx.rip, &info, (void**)&map, RTLD_DL_LINKMAP)) {
+		return;
 	}
 
 	ctx.function = (uint64_t) info.dli_saddr;
 	ctx.dli_fname = info.dli_fname;
 	ctx.load_offset = (uint64_t) map->l_addr;
 
+	{
+		std::lock_guard<std::mutex> lock(dwarf_mutex);
 
-	Dwarf_Debug dbg;
-	if (util::find_debug_info(ctx.dli_fname, &dbg)) {
-		return ctx;
+		Dwarf_Debug dbg;
+		if (util::find_debug_info(ctx.dli_fname, &dbg)) {
+			return;
+		}
+		ctx.dbg = dbg;
+
+		uint64_t adjusted_ip = ctx.rip - ctx.load_offset;
+		int line_no = -1;
+		const char* fname = NULL;
+		std::string func_name, linkage_name;	
+		util::find_line_info_with_dbg(dbg, adjusted_ip, &line_no, &fname, func_name, linkage_name);
+		ctx.address_line = line_no;	
+		ctx.src_filename = fname;
 	}
-	ctx.dbg = dbg;
-
-	uint64_t adjusted_ip = ctx.rip - ctx.load_offset;
-	int line_no = -1;
-	const char* fname = NULL;
-	std::string func_name, linkage_name;	
-	util::find_line_info_with_dbg(dbg, adjusted_ip, &line_no, &fname, func_name, linkage_name);
-	ctx.address_line = line_no;	
-	ctx.src_filename = fname;
 	
-	if (line_no == -1)
-		return ctx;
+	if (ctx.address_line == -1)
+		return;
 	
-	// Now we will find the debug info for this function
-	for (auto header: *registered_function_headers) {
-		if (header->identified_filename == NULL || header->identified_line == -1) {
-			int line_no = -1;
-			const char* fname = NULL;
-			uint64_t adjusted_ip = (uint64_t)header->function_addr - (uint64_t)ctx.load_offset;
-			util::find_line_info_with_dbg(dbg, adjusted_ip, &line_no, &fname, func_name, linkage_name);
-			header->identified_filename = fname;
-			header->identified_line = line_no;
-		}
-		if (header->identified_filename == NULL || header->identified_line == -1)
-			continue;
-		if (strcmp(header->identified_filename, ctx.src_filename) == 0) {
-			if (header->identified_line <= ctx.address_line 
-				&& header->identified_line + header->source_table_len > ctx.address_line) {
-				ctx.header = header;
-				ctx.function_line = header->identified_line;
-				break;
-			}
+	// Now we will find the debug info for this function in the module's registry
+	d2x_function_header* header = find_header((uint64_t) info.dli_fbase, ctx.dbg, ctx.rip - ctx.load_offset, ctx);
+	if (header != nullptr) {
+		ctx.header = header;
+		ctx.function_line = header->identified_line;
+	}
+}
+
+struct d2x_context find_context(void* ip, void* sp, void* bp, void* bx) {
+	struct d2x_thread_state &ts = thread_state;
+	uint64_t generation = registry_removals;
+	uint64_t registrations = registry_generation;
+	if (ts.last_ip == ip && ts.last_sp == sp && ts.last_generation == generation
+			&& (ts.last_ctx.header != nullptr || ts.last_registrations == registrations)) 
+		return ts.last_ctx;
+	else {
+		ts.current_frame_index = 0;		
+	}
+
+	struct d2x_context ctx;
+	struct d2x_cached_context entry;
+	bool cached;
+	{
+		std::lock_guard<std::mutex> lock(pc_context_mutex);
+		// Cached contexts may point to headers of unloaded modules
+		if (pc_context_generation != generation) {
+			pc_context_cache.clear();
+			pc_context_generation = generation;
 		}
+		cached = pc_context_cache.get((uint64_t) ip, entry) 
+			&& (entry.ctx.header != nullptr || entry.registrations == registrations);
+		if (cached)
+			ctx = entry.ctx;
 	}
-		
+
+	ctx.rip = (uint64_t) ip;
+	ctx.rsp = (uint64_t) sp;
+	ctx.rbp = (uint64_t) bp;
+	ctx.rbx = (uint64_t) bx;
+
+	if (!cached) {
+		find_location(ctx);
+		std::lock_guard<std::mutex> lock(pc_context_mutex);
+		entry.ctx = ctx;
+		entry.registrations = registrations;
+		pc_context_cache.put((uint64_t) ip, entry);
+	}
+
+	ts.last_ip = ip;
+	ts.last_sp = sp;
+	ts.last_generation = generation;
+	ts.last_registrations = registrations;
+	ts.last_ctx = ctx;
 	return ctx;
 }
+// DSL source files referenced by the tables are mapped once and indexed by line
+// so listings near the end of large files don't have to reread them. Entries
+// are refreshed when the file's size or mtime changes.
+struct d2x_source_file {
+	const char* data = nullptr;
+	size_t size = 0;
+	struct timespec mtime;
+	// Offset of the first character of each line
+	std::vector<size_t> line_offsets;
+};
+static std::map<std::string, struct d2x_source_file> source_file_cache;
+static std::mutex source_file_mutex;
+
+static void release_source_file(struct d2x_source_file &file) {
+	if (file.data != nullptr)
+		munmap((void*)file.data, file.size);
+	file.data = nullptr;
+	file.size = 0;
+	file.line_offsets.clear();
+}
+
+static bool load_source_file(const std::string &filename, const struct stat &st, struct d2x_source_file &file) {
+	file.size = st.st_size;
+	file.mtime = st.st_mtim;
+	file.line_offsets.clear();
+	file.line_offsets.push_back(0);
+	// Empty files cannot be mapped, they just have no lines
+	if (file.size == 0)
+		return true;
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	void* data = mmap(NULL, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) 
+		return false;
+	file.data = (const char*) data;
+
+	const char* end = file.data + file.size;
+	const char* p = file.data;
+	while ((p = (const char*) memchr(p, '\n', end - p)) != nullptr) {
+		p++;
+		file.line_offsets.push_back(p - file.data);
+	}
+	return true;
+}
+
+// Reads lines [bline, eline] (1 based, inclusive) of filename. Lines past the end of
+// the file are not returned.
+static bool read_source_lines(const std::string &filename, int bline, int eline, std::vector<std::string> &lines) {
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+		return false;
+
+	std::lock_guard<std::mutex> lock(source_file_mutex);
+	auto it = source_file_cache.find(filename);
+	if (it != source_file_cache.end()) {
+		struct d2x_source_file &file = it->second;
+		if ((size_t)st.st_size != file.size || st.st_mtim.tv_sec != file.mtime.tv_sec 
+			|| st.st_mtim.tv_nsec != file.mtime.tv_nsec) {
+			release_source_file(file);
+			source_file_cache.erase(it);
+			it = source_file_cache.end();
+		}
+	}
+	if (it == source_file_cache.end()) {
+		struct d2x_source_file file;
+		if (!load_source_file(filename, st, file))
+			return false;
+		it = source_file_cache.insert(std::make_pair(filename, file)).first;
+	}
+
+	struct d2x_source_file &file = it->second;
+	// A trailing newline does not start a new line
+	int num_lines = (int)file.line_offsets.size();
+	if (file.size == 0 || file.data[file.size - 1] == '\n')
+		num_lines--;
+	if (bline < 1)
+		bline = 1;
+	if (eline > num_lines)
+		eline = num_lines;
+	for (int l = bline; l <= eline; l++) {
+		size_t begin = file.line_offsets[l - 1];
+		size_t end = (l < (int)file.line_offsets.size()) ? file.line_offsets[l] - 1 : file.size;
+		lines.push_back(std::string(file.data + begin, end - begin));
+	}
+	return true;
+}
+
 static std::string basename(const std::string& pathname)
 {
     return {std::find_if(pathname.rbegin(), pathname.rend(),
@@ -110,24 +705,58 @@ static std::string basename(const std::string& pathname)
             pathname.end()};
 }
 
-std::string get_backtrace(struct d2x_context ctx) {
+// Results are collected into these before being rendered as text or as records
+struct d2x_frame_info {
+	std::string function;
+	int foffset;
+	std::string filename;
+	int line;
+};
+struct d2x_var_info {
+	std::string name;
+	std::string value;
+	bool truncated;
+};
+struct d2x_break_info {
+	int id;
+	int status;
+	std::string filename;
+	int line;
+	std::string condition;
+	int locations;
+};
+
+static std::vector<struct d2x_frame_info> collect_backtrace(struct d2x_context &ctx) {
+	std::vector<struct d2x_frame_info> frames;
 	if (ctx.header == nullptr)
-		return "";
+		return frames;
 	if (ctx.address_line == -1 || ctx.function_line == -1)
-		return "";
+		return frames;
 
-	std::stringstream oss;
 	int line_offset = ctx.address_line - ctx.function_line;
-
 	struct d2x_source_stack stack = ctx.header->source_table[line_offset];
 	struct d2x_source_loc *locs = ctx.header->source_list;
 	const char** string_table = ctx.header->string_table;
 	for (int i = 0; i < stack.stack_size; i++) {
 		struct d2x_source_loc loc = locs[i + stack.stack_offset];
-		if (loc.foffset != -1)
-			oss << "#" << i << " in " << string_table[loc.function] << ":" << loc.foffset << " at " << basename(string_table[loc.filename]) << ":" << loc.linenumber << "\n";
+		struct d2x_frame_info frame;
+		frame.function = string_table[loc.function];
+		frame.foffset = loc.foffset;
+		frame.filename = string_table[loc.filename];
+		frame.line = loc.linenumber;
+		frames.push_back(frame);
+	}
+	return frames;
+}
+
+std::string get_backtrace(struct d2x_context ctx) {
+	std::stringstream oss;
+	std::vector<struct d2x_frame_info> frames = collect_backtrace(ctx);
+	for (int i = 0; i < (int) frames.size(); i++) {
+		if (frames[i].foffset != -1)
+			oss << "#" << i << " in " << frames[i].function << ":" << frames[i].foffset << " at " << basename(frames[i].filename) << ":" << frames[i].line << "\n";
 		else
-			oss << "#" << i << " in " << string_table[loc.function] << " at " << basename(string_table[loc.filename]) << ":" << loc.linenumber << "\n";
+			oss << "#" << i << " in " << frames[i].function << " at " << basename(frames[i].filename) << ":" << frames[i].line << "\n";
 	}
 	return oss.str();
 }
@@ -143,31 +772,26 @@ std::string get_listing(struct d2x_context ctx) {
 	struct d2x_source_stack stack = ctx.header->source_table[line_offset];
 	struct d2x_source_loc *locs = ctx.header->source_list;
 	const char** string_table = ctx.header->string_table;
-	struct d2x_source_loc loc = locs[current_frame_index + stack.stack_offset];
+	struct d2x_source_loc loc = locs[thread_state.current_frame_index + stack.stack_offset];
 	int linenumber = loc.linenumber;
 	int bline = linenumber - config_list_offset;
 	if (bline < 0)
 		bline = 0;
 	int eline = linenumber + config_list_offset;
 
-	int cline = 0;
 	std::string filename = string_table[loc.filename];
 
-	std::ifstream ifs;
-	ifs.open(filename, std::ifstream::in);	
-	std::string line;	
-	while (std::getline(ifs, line)) {
-		cline++;
-		if (cline < bline)
-			continue;
-		if (cline > eline)
-			break;
+	std::vector<std::string> lines;
+	if (bline < 1)
+		bline = 1;
+	read_source_lines(filename, bline, eline, lines);
+	for (int i = 0; i < (int)lines.size(); i++) {
+		int cline = bline + i;
 		if (cline == linenumber)
-			oss << ">" << cline << "\t" << line << "\n";
+			oss << ">" << cline << "\t" << lines[i] << "\n";
 		else 
-			oss << " " << cline << "\t" << line << "\n";
+			oss << " " << cline << "\t" << lines[i] << "\n";
 	}
-	ifs.close();
 	return oss.str();
 }
 
@@ -189,37 +813,28 @@ std::string get_frame(struct d2x_context ctx, const char* update_frame) {
 	struct d2x_source_stack stack = ctx.header->source_table[line_offset];
 	if (new_frame >= 0) {
 		if (new_frame < stack.stack_size) 
-			current_frame_index = new_frame;
+			thread_state.current_frame_index = new_frame;
 		else 
 			oss << "Warning: xFrame index " << new_frame << " is not valid. xFrame not updated\n";
 	}
 	struct d2x_source_loc *locs = ctx.header->source_list;
 	const char** string_table = ctx.header->string_table;
-	struct d2x_source_loc loc = locs[current_frame_index + stack.stack_offset];
+	struct d2x_source_loc loc = locs[thread_state.current_frame_index + stack.stack_offset];
 	int linenumber = loc.linenumber;
 
 	if (loc.foffset != -1) 
-		oss << "#" << current_frame_index << " in " << string_table[loc.function] << ":" << loc.foffset << " at " << basename(string_table[loc.filename]) << ":" << loc.linenumber << "\n";
+		oss << "#" << thread_state.current_frame_index << " in " << string_table[loc.function] << ":" << loc.foffset << " at " << basename(string_table[loc.filename]) << ":" << loc.linenumber << "\n";
 	else 
-		oss << "#" << current_frame_index << " in " << string_table[loc.function] << " at " << basename(string_table[loc.filename]) << ":" << loc.linenumber << "\n";
+		oss << "#" << thread_state.current_frame_index << " in " << string_table[loc.function] << " at " << basename(string_table[loc.filename]) << ":" << loc.linenumber << "\n";
 
-	int cline = 0;
 	std::string filename = string_table[loc.filename];
-	std::ifstream ifs;
-	ifs.open(filename, std::ifstream::in);	
-	std::string line;	
-	while (std::getline(ifs, line)) {
-		cline++;
-		if (cline == linenumber) {
-			oss << cline << "\t" << line << "\n";
-			break;
-		}
-	}
-	ifs.close();
+	std::vector<std::string> lines;
+	if (read_source_lines(filename, linenumber, linenumber, lines) && lines.size() == 1)
+		oss << linenumber << "\t" << lines[0] << "\n";
 	return oss.str();	
 }
 
-std::string get_xfilename_ctx(struct d2x_context ctx) {
+static std::string get_xfilename_ctx(struct d2x_context ctx) {
 	if (ctx.header == nullptr)
 		return "";
 	if (ctx.address_line == -1 || ctx.function_line == -1)
@@ -228,14 +843,12 @@ std::string get_xfilename_ctx(struct d2x_context ctx) {
 	struct d2x_source_stack stack = ctx.header->source_table[line_offset];
 	struct d2x_source_loc *locs = ctx.header->source_list;
 	const char** string_table = ctx.header->string_table;
-	struct d2x_source_loc loc = locs[current_frame_index + stack.stack_offset];
+	struct d2x_source_loc loc = locs[thread_state.current_frame_index + stack.stack_offset];
 
 	std::string filename = string_table[loc.filename];
 	return filename;	
 }
 
-static struct d2x_context* active_frame_ctx = nullptr;
-
 static std::string find_die_name(Dwarf_Debug dbg, Dwarf_Die die) {
 	char* name = NULL;
 	Dwarf_Error de;
@@ -313,7 +926,7 @@ static void* decode_address_from_die(Dwarf_Debug dbg, Dwarf_Die die, uint64_t fr
 		uint64_t res;
 
 		Dwarf_Small op;
-		Dwarf_Unsigned opd1 = 0, opd2 = 0, opd3 = 0, opd4 = 0;
+		Dwarf_Unsigned opd1 = 0, opd2 = 0, opd3 = 0;
 		Dwarf_Unsigned offsetforbranch = 0;
 		dwarf_get_location_op_value_c(desc, 0, &op, &opd1, &opd2, &opd3, &offsetforbranch, &de);
 		if (op != DW_OP_fbreg) 
@@ -333,14 +946,34 @@ static void* decode_address_from_die(Dwarf_Debug dbg, Dwarf_Die die, uint64_t fr
 	return NULL;
 }
 
-static void* find_var_address_in_subprogram(Dwarf_Debug dbg, Dwarf_Die die, uint64_t pc, const char* varname, uint64_t frame_base) {	
+// Size of the object described by die, following DW_AT_type through typedefs and qualifiers. 
+// 0 if it cannot be determined
+static size_t find_type_size(Dwarf_Debug dbg, Dwarf_Die die) {
+	Dwarf_Attribute at;
+	Dwarf_Error de;
+	Dwarf_Unsigned size;
+	// Bound the walk in case of malformed type chains
+	for (int depth = 0; depth < 16; depth++) {
+		if (dwarf_attr(die, DW_AT_byte_size, &at, &de) == DW_DLV_OK 
+			&& dwarf_formudata(at, &size, &de) == DW_DLV_OK) 
+			return size;
+		if (dwarf_attr(die, DW_AT_type, &at, &de) != DW_DLV_OK)
+			return 0;
+		Dwarf_Off off;
+		Dwarf_Die type;
+		if (dwarf_global_formref(at, &off, &de) != DW_DLV_OK)
+			return 0;
+		if (dwarf_offdie(dbg, off, &type, &de) != DW_DLV_OK)
+			return 0;
+		die = type;
+	}
+	return 0;
+}
+
+static void* find_var_address_in_subprogram(Dwarf_Debug dbg, Dwarf_Die die, uint64_t pc, const char* varname, uint64_t frame_base, size_t* size) {	
 	Dwarf_Half tag;
 	Dwarf_Die child;
 	Dwarf_Error de;
-	Dwarf_Unsigned lopc, hipc;
-
-	Dwarf_Half ret_form;
-	enum Dwarf_Form_Class ret_class;
 
 	if (dwarf_child(die, &child, &de) == DW_DLV_OK) {	
 		while(1) {
@@ -348,6 +981,8 @@ static void* find_var_address_in_subprogram(Dwarf_Debug dbg, Dwarf_Die die, uint
 			if (tag == DW_TAG_variable || tag == DW_TAG_formal_parameter) {
 				std::string vname = find_die_name(dbg, child);
 				if (vname == varname) {
+					if (size != NULL)
+						*size = find_type_size(dbg, child);
 					return decode_address_from_die(dbg, child, frame_base);
 				}
 			}					
@@ -362,7 +997,7 @@ static void* find_var_address_in_subprogram(Dwarf_Debug dbg, Dwarf_Die die, uint
 		while(1) {
 			dwarf_tag(child, &tag, &de);
 			if (tag == DW_TAG_lexical_block) {
-				return find_var_address_in_subprogram(dbg, child, pc, varname, frame_base);
+				return find_var_address_in_subprogram(dbg, child, pc, varname, frame_base, size);
 			// TODO: Fix this to check only those lexical block that are live at the address range
 			/*	
 				if (dwarf_lowpc(child, &lopc, &de) == DW_DLV_OK) {
@@ -373,7 +1008,7 @@ static void* find_var_address_in_subprogram(Dwarf_Debug dbg, Dwarf_Die die, uint
 						hipc += lopc;
 					if (pc >= lopc && pc < hipc) {
 						// This is the function
-						return find_var_address_in_subprogram(dbg, child, pc, varname, frame_base);
+						return find_var_address_in_subprogram(dbg, child, pc, varname, frame_base, size);
 					}
 			
 				} else {
@@ -392,7 +1027,7 @@ static void* find_var_address_in_subprogram(Dwarf_Debug dbg, Dwarf_Die die, uint
 	return NULL;
 }
 
-static void* find_var_address_in_die(Dwarf_Debug dbg, Dwarf_Die die, uint64_t pc, const char* varname, uint64_t frame_base) {
+static void* find_var_address_in_die(Dwarf_Debug dbg, Dwarf_Die die, uint64_t pc, const char* varname, uint64_t frame_base, size_t* size) {
 	Dwarf_Half tag;
 	Dwarf_Error de;
 	Dwarf_Unsigned lopc, hipc;
@@ -408,14 +1043,14 @@ static void* find_var_address_in_die(Dwarf_Debug dbg, Dwarf_Die die, uint64_t pc
 				hipc += lopc;
 			if (pc >= lopc && pc < hipc) {
 				// This is the function
-				return find_var_address_in_subprogram(dbg, die, pc, varname, frame_base);
+				return find_var_address_in_subprogram(dbg, die, pc, varname, frame_base, size);
 			}
 		}
 	} else {
 		Dwarf_Die child;
 		if (dwarf_child(die, &child, &de) == DW_DLV_OK) {
 			while (1) {
-				void* ret = find_var_address_in_die(dbg, child, pc, varname, frame_base);
+				void* ret = find_var_address_in_die(dbg, child, pc, varname, frame_base, size);
 				if (ret != NULL)
 					return ret;
 				Dwarf_Die sibling;
@@ -428,10 +1063,9 @@ static void* find_var_address_in_die(Dwarf_Debug dbg, Dwarf_Die die, uint64_t pc
 	return NULL;
 }
 
-static void* find_var_loc(struct d2x_context ctx, const char* varname) {
-
-	void* ret_val = NULL;
-
+// Unwinds the frame described by ctx. Returns the address execution returns to in the 
+// caller and the canonical frame address, which is also the caller's stack pointer
+static void unwind_frame(struct d2x_context &ctx, uint64_t* return_ip, uint64_t* frame_cfa) {
 	unw_cursor_t cursor, cursor_next;
 	unw_context_t context;
 	context.uc_mcontext.gregs[REG_RBP] = ctx.rbp;
@@ -442,17 +1076,47 @@ static void* find_var_loc(struct d2x_context ctx, const char* varname) {
 	cursor_next = cursor;
 	unw_step(&cursor_next);	
 
-	unw_word_t sp_next;
+	unw_word_t sp_next, ip_next;
 	unw_get_reg(&cursor_next, UNW_REG_SP, &sp_next);
+	unw_get_reg(&cursor_next, UNW_REG_IP, &ip_next);
+	*return_ip = ip_next;
+	*frame_cfa = sp_next;
+}
+
+void* find_var_loc(struct d2x_context ctx, const char* varname, size_t* size) {
+
+	void* ret_val = NULL;
+
+	uint64_t ip_next, sp_next;
+	unwind_frame(ctx, &ip_next, &sp_next);
+
+	if (ctx.dbg == nullptr)
+		return NULL;
+	std::lock_guard<std::mutex> lock(dwarf_mutex);
 
 	// We have obtained the base register
 	// Now to find the address of the variable
 	uint64_t adjusted_ip = (uint64_t)ctx.rip - (uint64_t)ctx.load_offset;
-	Dwarf_Die cu_die = util::find_cu_die(ctx.dbg, adjusted_ip);
+	Dwarf_Die cu_die = NULL;
+	// With an index only the DIE of the var itself is read
+	if (util::has_debug_index(ctx.dbg)) {
+		Dwarf_Off var_off;
+		Dwarf_Die var_die;
+		Dwarf_Error de;
+		if (util::find_var_die_offset(ctx.dbg, adjusted_ip, varname, &var_off) == 0 
+				&& dwarf_offdie(ctx.dbg, var_off, &var_die, &de) == DW_DLV_OK) {
+			if (size != NULL)
+				*size = find_type_size(ctx.dbg, var_die);
+			ret_val = decode_address_from_die(ctx.dbg, var_die, sp_next);
+			dwarf_dealloc(ctx.dbg, var_die, DW_DLA_DIE);
+		}
+		return ret_val;
+	}
+	cu_die = util::find_cu_die(ctx.dbg, adjusted_ip);
 	if (cu_die == NULL) 
 		goto cleanup;	
 	
-	ret_val = find_var_address_in_die(ctx.dbg, cu_die, adjusted_ip, varname, sp_next);
+	ret_val = find_var_address_in_die(ctx.dbg, cu_die, adjusted_ip, varname, sp_next, size);
 	
 
 
@@ -464,57 +1128,254 @@ cleanup:
 	return ret_val;	
 }
 
-std::string get_fvl(struct d2x_context ctx, const char* varname) {
+static std::string get_fvl(struct d2x_context ctx, const char* varname) {
 	std::stringstream oss;
 	oss << "&" << varname << " = " << find_var_loc(ctx, varname) << std::endl;
 	return oss.str();
 }
-// Should only be called from the rtv_handler
-namespace rtv {
-	void* find_stack_var(std::string varname) {
-		return find_var_loc(*active_frame_ctx, varname.c_str());
+// Why a resolver was stopped
+#define D2X_RESOLVER_OUT_OF_TIME 1
+#define D2X_RESOLVER_OUT_OF_OUTPUT 2
+
+// Thrown from the runtime calls of a resolver that is out of budget and caught in 
+// render_var_value, so the resolver unwinds without running any further
+struct d2x_resolver_stopped {};
+
+static bool resolver_over_budget(void) {
+	struct d2x_thread_state &ts = thread_state;
+	if (ts.active_sink == nullptr)
+		return false;
+	if (ts.resolver_stop == 0 && config_resolver_time_budget_ms != 0 
+			&& std::chrono::steady_clock::now() > ts.resolver_deadline)
+		ts.resolver_stop = D2X_RESOLVER_OUT_OF_TIME;
+	return ts.resolver_stop != 0;
+}
+
+// Appends to the active sink up to the output budget, false if the value had to be cut. The 
+// budget starts at the window, bytes before it are only counted so every page can be reached
+static bool sink_append_within_budget(const char* data, size_t size) {
+	struct d2x_value_sink &sink = *thread_state.active_sink;
+	size_t limit = sink.offset + std::min<size_t>(config_resolver_output_budget, SIZE_MAX - sink.offset);
+	if (config_resolver_output_budget != 0 && sink.written + size > limit) {
+		if (sink.written < limit)
+			sink_append(sink, data, limit - sink.written);
+		thread_state.resolver_stop = D2X_RESOLVER_OUT_OF_OUTPUT;
+		return false;
 	}
+	sink_append(sink, data, size);
+	return true;
 }
 
-std::string get_vars(struct d2x_context ctx, const char* varname) {
+// Should only be called from the rtv_handler
+static void* rtv_find_stack_var(std::string varname) {
+	if (resolver_over_budget())
+		throw d2x_resolver_stopped();
+	return find_var_loc(*thread_state.active_frame_ctx, varname.c_str());
+}
+static void rtv_sink_write(std::string value) {
+	if (thread_state.active_sink == nullptr)
+		return;
+	if (resolver_over_budget() || !sink_append_within_budget(value.c_str(), value.size()))
+		throw d2x_resolver_stopped();
+}
+static int rtv_sink_full(void) {
+	return thread_state.active_sink == nullptr || sink_full(*thread_state.active_sink) || resolver_over_budget();
+}
+static int rtv_budget_exhausted(void) {
+	return resolver_over_budget();
+}
+
+// Returns the var entry for varname at the location of ctx, nullptr if it isn't live there
+static const struct d2x_var_entry* find_var_entry(struct d2x_context &ctx, const char* varname) {
 	if (ctx.header == nullptr)
-		return "";
+		return nullptr;
 	if (ctx.address_line == -1 || ctx.function_line == -1)
-		return "";
-	
+		return nullptr;
+	int line_offset = ctx.address_line - ctx.function_line;
+	struct d2x_var_stack stack = ctx.header->var_table[line_offset];
+	struct d2x_var_entry *vars = ctx.header->var_list;
+	const char** string_table = ctx.header->string_table;
+	for (int i = 0; i < stack.stack_size; i++) {
+		if (strcmp(string_table[vars[stack.stack_offset + i].varname], varname) == 0) 
+			return &vars[stack.stack_offset + i];
+	}
+	return nullptr;
+}
+
+// Renders the value of a var into sink, invoking its runtime resolver if it has one. 
+// Resolvers can write large values in pieces with rtv::sink_write and stop when 
+// rtv::sink_full returns true. Whatever they return is appended after that. 
+// Resolvers that run out of budget keep what they wrote so far followed by a marker
+static void render_var_value(struct d2x_context &ctx, const struct d2x_var_entry* var, struct d2x_value_sink &sink) {
+	const char** string_table = ctx.header->string_table;
+	if (var->varvalue != -1) {
+		sink_append(sink, string_table[var->varvalue], strlen(string_table[var->varvalue]));
+		return;
+	}
+	auto varname = string_table[var->varname];
+	struct d2x_thread_state &ts = thread_state;
+	ts.active_frame_ctx = &ctx;
+	ts.active_sink = &sink;
+	ts.resolver_stop = 0;
+	ts.resolver_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(config_resolver_time_budget_ms);
+	auto func = (std::string (*)(std::string))var->rvarvalue;
+	try {
+		std::string value = func(varname);
+		sink_append_within_budget(value.c_str(), value.size());
+	} catch (const d2x_resolver_stopped&) {
+	}
+	ts.active_sink = nullptr;
+	ts.active_frame_ctx = nullptr;
+
+	std::stringstream marker;
+	if (ts.resolver_stop == D2X_RESOLVER_OUT_OF_TIME)
+		marker << " <resolver stopped after " << config_resolver_time_budget_ms << " ms>";
+	else if (ts.resolver_stop == D2X_RESOLVER_OUT_OF_OUTPUT)
+		marker << " <resolver stopped after " << config_resolver_output_budget << " bytes>";
+	std::string m = marker.str();
+	sink_append(sink, m.c_str(), m.size());
+}
+
+static std::string render_var_value(struct d2x_context &ctx, const struct d2x_var_entry* var, size_t offset, size_t len, bool* more) {
+	std::vector<char> buffer(len);
+	struct d2x_value_sink sink;
+	sink.buffer = buffer.data();
+	sink.offset = offset;
+	sink.len = len;
+	render_var_value(ctx, var, sink);
+	*more = sink_full(sink);
+	return std::string(buffer.data(), sink.stored);
+}
+
+long long get_value_chunk(struct d2x_context ctx, const char* varname, char* buffer, size_t offset, size_t len) {
+	const struct d2x_var_entry* var = find_var_entry(ctx, varname);
+	if (var == nullptr)
+		return -1;
+	struct d2x_value_sink sink;
+	sink.buffer = buffer;
+	sink.offset = offset;
+	sink.len = len;
+	render_var_value(ctx, var, sink);
+	return sink.stored;
+}
+
+std::string get_value(struct d2x_context ctx, const char* varname, size_t offset, size_t len) {
 	std::stringstream oss;
+	const struct d2x_var_entry* var = find_var_entry(ctx, varname);
+	if (var == nullptr) {
+		oss << "xVar " << varname << " not found at current location\n";
+		return oss.str();
+	}
+	bool more;
+	oss << render_var_value(ctx, var, offset, len, &more) << "\n";
+	if (more)
+		oss << "(more at offset " << offset + len << ")\n";
+	return oss.str();
+}
 
+// Vars live at the location of ctx, with their values summarized if with_values is set
+static std::vector<struct d2x_var_info> collect_vars(struct d2x_context &ctx, bool with_values) {
+	std::vector<struct d2x_var_info> ret;
+	if (ctx.header == nullptr)
+		return ret;
+	if (ctx.address_line == -1 || ctx.function_line == -1)
+		return ret;
 	int line_offset = ctx.address_line - ctx.function_line;
 	struct d2x_var_stack stack = ctx.header->var_table[line_offset];
 	struct d2x_var_entry *vars = ctx.header->var_list;
 	const char** string_table = ctx.header->string_table;
+	for (int i = 0; i < stack.stack_size; i++) {
+		struct d2x_var_info var;
+		var.name = string_table[vars[stack.stack_offset + i].varname];
+		var.truncated = false;
+		if (with_values)
+			var.value = render_var_value(ctx, &vars[stack.stack_offset + i], 0, config_value_summary_len, &var.truncated);
+		ret.push_back(var);
+	}
+	return ret;
+}
+
+std::string get_vars(struct d2x_context ctx, const char* varname) {
+	if (ctx.header == nullptr)
+		return "";
+	if (ctx.address_line == -1 || ctx.function_line == -1)
+		return "";
 	
-	int tofind = 0;	
-	if (strcmp(varname, ""))
-		tofind = 1;
-	int found = 0;
+	std::stringstream oss;
 
-	for (int i = 0; i < stack.stack_size; i++) {
-		if (tofind) {
-			if (strcmp(string_table[vars[stack.stack_offset + i].varname], varname) == 0) {
-				if (vars[stack.stack_offset + i].varvalue != -1)
-					oss << string_table[vars[stack.stack_offset + i].varname] << " = " << string_table[vars[stack.stack_offset + i].varvalue] << "\n";	
-				else {
-					auto varname = string_table[vars[stack.stack_offset + i].varname];
-					active_frame_ctx = &ctx;
-					auto func = (std::string (*)(std::string))vars[stack.stack_offset + i].rvarvalue;
-					oss << varname << " = " << func(varname) << std::endl;
-					active_frame_ctx = nullptr;
-				}
-				found = 1;
-				break;
-			}
-		} else 
-			oss << (i+1) << ". " << string_table[vars[stack.stack_offset + i].varname] << "\n";
-	}	
-	if (tofind == 1 && found == 0) {
-		oss << "xVar " << varname << " not found at current location\n";
+	if (strcmp(varname, "")) {
+		const struct d2x_var_entry* var = find_var_entry(ctx, varname);
+		if (var == nullptr) 
+			oss << "xVar " << varname << " not found at current location\n";
+		else {
+			bool more;
+			oss << varname << " = " << render_var_value(ctx, var, 0, config_value_summary_len, &more);
+			if (more) 
+				oss << " ... (truncated, use xvalue " << varname << " <offset> [<len>] to page)";
+			oss << "\n";
+		}
+		return oss.str();
+	}
+
+	std::vector<struct d2x_var_info> vars = collect_vars(ctx, false);
+	for (int i = 0; i < (int) vars.size(); i++) 
+		oss << (i+1) << ". " << vars[i].name << "\n";
+	return oss.str();
+}
+
+static int watch_counter = 0;
+
+std::string get_watch(struct d2x_context ctx, const char* varname, std::ostream &output_command_file) {
+	std::stringstream oss;
+	if (strcmp(varname, "") == 0) {
+		oss << "Command requires an xvar name" << std::endl;
+		return oss.str();
+	}
+	if (find_var_entry(ctx, varname) == nullptr) {
+		oss << "xVar " << varname << " not found at current location" << std::endl;
+		return oss.str();
+	}
+	size_t size = 0;
+	void* addr = find_var_loc(ctx, varname, &size);
+	if (addr == NULL) {
+		oss << "Cannot find the address of " << varname << " in the current frame" << std::endl;
+		return oss.str();
+	}
+
+	// Use an access of the exact width so gdb can use a single debug register when possible
+	std::stringstream expr;
+	switch (size) {
+		case 1: expr << "*(char*)" << addr; break;
+		case 2: expr << "*(short*)" << addr; break;
+		case 4: expr << "*(int*)" << addr; break;
+		case 8: expr << "*(long*)" << addr; break;
+		case 0: 
+			oss << "Warning: size of " << varname << " is unknown, watching 8 bytes" << std::endl;
+			expr << "*(long*)" << addr; 
+			break;
+		default: expr << "*(char(*)[" << size << "])" << addr; break;
 	}
+
+	int watch_id = watch_counter++;
+	output_command_file << "watch " << expr.str() << std::endl;
+	output_command_file << "set $d2x_wp_" << watch_id << " = $bpnum" << std::endl;
+	output_command_file << "commands" << std::endl;
+	output_command_file << "xbt" << std::endl;
+	output_command_file << "end" << std::endl;
+	uint64_t return_ip = 0, frame_cfa = 0;
+	unwind_frame(ctx, &return_ip, &frame_cfa);
+	// Remove the watchpoint once the generated function that owns the variable returns.
+	// The stack pointer check skips returns of deeper recursive instances. The inferior stays 
+	// stopped there, resuming from the commands would lose a stop the user is stepping to
+	if (return_ip != 0) {
+		output_command_file << "tbreak *" << (void*)return_ip << " if $sp >= " << (void*)frame_cfa << std::endl;
+		output_command_file << "commands" << std::endl;
+		output_command_file << "silent" << std::endl;
+		output_command_file << "delete $d2x_wp_" << watch_id << std::endl;
+		output_command_file << "echo xWatch on " << varname << " removed, the variable went out of scope\\n" << std::endl;
+		output_command_file << "end" << std::endl;
+	}
+	oss << "Watching " << varname << " (" << size << " bytes at " << addr << ")" << std::endl;
 	return oss.str();
 }
 
@@ -531,39 +1392,195 @@ static bool compare_paths(std::string spec_path, std::string path) {
 	}
 }
 
-static std::vector<std::pair<std::string, int>> find_all_breaks(struct d2x_context ctx, std::string spec_filename, int spec_line_no) {
-	std::vector<std::pair<std::string, int>> to_ret;
+// Reverse index from a DSL (file, line) to the generated lines that have it at the top
+// of their extended stack. Built lazily on the first xbreak and rebuilt when modules
+// are loaded or unloaded.
+typedef std::vector<std::pair<d2x_function_header*, int>> break_locations_t;
+static std::map<std::string, std::map<int, break_locations_t>> break_index;
+static uint64_t break_index_generation = 0;
+static std::mutex break_index_mutex;
+
+static void build_break_index(struct d2x_context ctx) {
+	break_index.clear();
+	break_index_generation = registry_generation;
 
-	for (auto header: *registered_function_headers) {
+	for (auto header: all_headers()) {
 		if (header->identified_filename == NULL || header->identified_line == -1)
 			continue;	
-		// For each header iterate through each line and check if it has the source_spec at the "top" of 
-		// the extended stack
 		
-		struct d2x_source_loc *locs = ctx.header->source_list;
-		const char** string_table = ctx.header->string_table;
-
+		struct d2x_source_loc *locs = header->source_list;
+		const char** string_table = header->string_table;
+		
+		const char* prev_filename = nullptr;
+		int prev_linenumber = -1;
 		for (int line_no = 0; line_no < header->source_table_len; line_no++) {
-			struct d2x_source_stack stack = ctx.header->source_table[line_no];
-			struct d2x_source_loc loc = locs[0 + stack.stack_offset];
+			struct d2x_source_stack stack = header->source_table[line_no];
+			if (stack.stack_size == 0) {
+				prev_filename = nullptr;
+				continue;
+			}
 			// This is the extended source of the top of the stack 
 			// for the generated line of code
-			int linenumber = loc.linenumber;
-			std::string filename = string_table[loc.filename];
-			if (compare_paths(spec_filename, filename) && linenumber == spec_line_no) {
-				to_ret.push_back(std::make_pair(header->identified_filename, header->identified_line + line_no));
-			}
+			struct d2x_source_loc loc = locs[0 + stack.stack_offset];
+			const char* filename = string_table[loc.filename];
+			// Consecutive generated lines for the same DSL line need only one stop
+			if (prev_filename != nullptr && loc.linenumber == prev_linenumber 
+				&& strcmp(prev_filename, filename) == 0)
+				continue;
+			prev_filename = filename;
+			prev_linenumber = loc.linenumber;
+			break_index[filename][loc.linenumber].push_back(std::make_pair(header, line_no));
 		}
 	}
+}
+
+break_locations_t find_all_breaks(struct d2x_context ctx, std::string spec_filename, int spec_line_no) {
+	std::lock_guard<std::mutex> lock(break_index_mutex);
+	if (break_index_generation != registry_generation || break_index.empty())
+		build_break_index(ctx);
+
+	break_locations_t to_ret;
+	// The spec may be a suffix of the path so every distinct DSL file is checked,
+	// lines are then a direct lookup
+	for (auto &file: break_index) {
+		if (!compare_paths(spec_filename, file.first))
+			continue;
+		auto it = file.second.find(spec_line_no);
+		if (it == file.second.end())
+			continue;
+		to_ret.insert(to_ret.end(), it->second.begin(), it->second.end());
+	}
 	return to_ret;	
 }
 
 static std::vector<std::pair<std::string, int>> break_points_records;
-static std::vector<std::vector<std::pair<std::string, int>>> break_points_map;
+static std::vector<break_locations_t> break_points_map;
 static std::vector<int> break_points_status;
+// Range of gdb breakpoint numbers that implement each DSL breakpoint, -1 if unknown
+static std::vector<std::pair<int, int>> break_points_gdb;
+
+// Conditional breakpoints are evaluated in process at hook points, varname is empty
+// for regular breakpoints
+struct d2x_break_condition {
+	std::string varname;
+	std::string op;
+	std::string value;
+};
+static std::vector<struct d2x_break_condition> break_points_condition;
+
+// Hook sites (section anchor, line offset) -> IDs of the conditional breakpoints to check there
+struct d2x_hook_site {
+	d2x_function_header* header;
+	std::vector<int> break_ids;
+};
+static std::map<std::pair<uint64_t, int>, struct d2x_hook_site> hook_sites;
+static std::mutex hook_sites_mutex;
+static bool hook_trap_installed = false;
+static std::atomic<uint64_t> hook_sites_generation(0);
+
+/* Hooks run in every thread of the program, so they read an immutable snapshot of the hook 
+sites with the conditions to check instead of taking hook_sites_mutex. A new snapshot is 
+published whenever the sites change. Old snapshots are never freed since a hook may still 
+be reading one, they only change when breakpoints are edited */
+struct d2x_hook_check {
+	int break_id;
+	struct d2x_break_condition cond;
+};
+struct d2x_hook_snapshot_site {
+	d2x_function_header* header;
+	std::vector<struct d2x_hook_check> checks;
+};
+typedef std::map<std::pair<uint64_t, int>, struct d2x_hook_snapshot_site> hook_snapshot_t;
+static std::atomic<const hook_snapshot_t*> hook_snapshot(nullptr);
+
+// Should be called with the hook_sites_mutex held
+static void publish_hook_sites(void) {
+	hook_snapshot_t* snapshot = new hook_snapshot_t();
+	for (auto &site: hook_sites) {
+		struct d2x_hook_snapshot_site &s = (*snapshot)[site.first];
+		s.header = site.second.header;
+		for (auto break_id: site.second.break_ids)
+			s.checks.push_back({break_id, break_points_condition[break_id]});
+	}
+	hook_snapshot.store(snapshot, std::memory_order_release);
+	set_hooks_enabled(!hook_sites.empty());
+}
+static uint64_t break_points_generation = 0;
+
+// Drops hook sites of unloaded modules. Should be called with the hook_sites_mutex held
+static void prune_hook_sites(void) {
+	if (hook_sites_generation == registry_removals)
+		return;
+	hook_sites_generation = registry_removals.load();
+	for (auto it = hook_sites.begin(); it != hook_sites.end();) {
+		if (!is_registered(it->second.header))
+			it = hook_sites.erase(it);
+		else
+			++it;
+	}
+	publish_hook_sites();
+}
+
+// Drops breakpoint locations in unloaded modules. gdb removes its own breakpoints there
+static void prune_break_points(void) {
+	if (break_points_generation == registry_removals)
+		return;
+	break_points_generation = registry_removals;
+	for (auto &locs: break_points_map) {
+		locs.erase(std::remove_if(locs.begin(), locs.end(), 
+			[](const std::pair<d2x_function_header*, int> &b) { return !is_registered(b.first); }), locs.end());
+	}
+	std::lock_guard<std::mutex> lock(hook_sites_mutex);
+	prune_hook_sites();
+}
+
+static std::string condition_string(const struct d2x_break_condition &cond) {
+	return cond.varname + " " + cond.op + " " + cond.value;
+}
+
+// Parses the source spec for xbreak like commands. Returns false and writes the error to oss if it is malformed
+static bool parse_source_spec(struct d2x_context ctx, const char* source_spec, std::string &filename, int &line_no, std::ostream &oss) {
+	// There are two types of source_specs
+	// 1. just line number - this takes the filename (full path) from the from the current ctx and the specified line number
+	// 2. <filename>:<linenumber> - Filename can be a full path or just the filename and a line number
+	static char filename_s[1024];		
+	if (sscanf(source_spec, "%1023[^:]:%d", filename_s, &line_no) == 2) {
+		filename = filename_s;
+	} else if (sscanf(source_spec, "%d", &line_no) == 1) {
+		filename = get_xfilename_ctx(ctx);
+		if (filename == "") {
+			oss << "Cannot identify extended stack information for current location, aborting!" << std::endl;
+			return false;
+		}
+	} else {
+		oss << "Command requires a source spec of the form [<filename>:]<linenumber>" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Breakpoints that have not been deleted
+static std::vector<struct d2x_break_info> collect_breaks(void) {
+	std::vector<struct d2x_break_info> breaks;
+	for (int index = 0; index < (int) break_points_map.size(); index++) {
+		if (break_points_status[index] == 3) 
+			continue;
+		struct d2x_break_info b;
+		b.id = index;
+		b.status = break_points_status[index];
+		b.filename = break_points_records[index].first;
+		b.line = break_points_records[index].second;
+		if (break_points_condition[index].varname != "")
+			b.condition = condition_string(break_points_condition[index]);
+		b.locations = break_points_map[index].size();
+		breaks.push_back(b);
+	}
+	return breaks;
+}
 
 std::string get_break(struct d2x_context ctx, const char* source_spec, std::ostream &output_command_file) {
 	std::stringstream oss;
+	prune_break_points();
 	// There are two types of source_specs
 	// 1. just line number - this takes the filename (full path) from the from the current ctx and the specified line number
 	// 2. <filename>:<linenumber> - Filename can be a full path or just the filename and a line number
@@ -571,39 +1588,35 @@ std::string get_break(struct d2x_context ctx, const char* source_spec, std::ostr
 	if (spec == "") {
 		// Just list all the breakpoints
 		oss << "Following breakpoints exist:" << std::endl;
-		int index = 0;
-		for (auto b: break_points_map) {
-			if (break_points_status[index] == 3) {
-				index++;
-				continue;
-			}
-			oss << "#" << index << " [" << (break_points_status[index] == 1 ? "ENABLED": "DISABLED") << "] " 
-				<< break_points_records[index].first << ":" << break_points_records[index].second << std::endl;
-			index++;
+		for (auto &b: collect_breaks()) {
+			oss << "#" << b.id << " [" << (b.status == 1 ? "ENABLED": "DISABLED") << "] " 
+				<< b.filename << ":" << b.line;
+			if (b.condition != "")
+				oss << " if " << b.condition;
+			oss << " (" << b.locations << " locations)" << std::endl;
 		}
 		return oss.str();
 	}
 	std::string filename;
-	static char filename_s[1024];		
 	int line_no;
-	if (sscanf(source_spec, "%[^:]:%d", filename_s, &line_no) == 2) {
-		filename = filename_s;
-	} else if (sscanf(source_spec, "%d", &line_no) == 1) {
-		filename = get_xfilename_ctx(ctx);
-		if (filename == "") {
-			oss << "Cannot identify extended stack information for current location, aborting!" << std::endl;
-			return oss.str();
-		}
-	} else {
-		oss << "Command requires a source spec of the form [<filename>:]<linenumber>" << std::endl;
+	if (!parse_source_spec(ctx, source_spec, filename, line_no, oss))
 		return oss.str();
-	}
 	
-	std::vector<std::pair<std::string, int>> break_point_locs = find_all_breaks(ctx, filename, line_no);
+	break_locations_t break_point_locs = find_all_breaks(ctx, filename, line_no);
+	// gdb cannot attach several linespecs to one breakpoint, so the locations are inserted as 
+	// consecutively numbered breakpoints and the range is bound back to this ID. 
+	// All further operations on the ID then act on the whole range at once
+	int break_id = break_points_map.size();
+	bool first = true;
 	for (auto b: break_point_locs) {
-		output_command_file << "break " << b.first << ":" << b.second << std::endl;
+		output_command_file << "break " << b.first->identified_filename << ":" << b.first->identified_line + b.second << std::endl;
+		if (first)
+			output_command_file << "set $d2x_bp_first = $bpnum" << std::endl;
+		first = false;
 	}
-	oss << "Inserting " << break_point_locs.size() << " breakpoints with ID: #" << break_points_map.size()  << std::endl;
+	if (!first) 
+		output_command_file << "call (void)d2x::runtime::cmd::xbreak_bind(" << break_id << ", $d2x_bp_first, $bpnum)" << std::endl;
+	oss << "Inserting breakpoint with " << break_point_locs.size() << " locations with ID: #" << break_id << std::endl;
 	
 	// Breakpoint status
 	// 1 - Active
@@ -613,12 +1626,83 @@ std::string get_break(struct d2x_context ctx, const char* source_spec, std::ostr
 	break_points_status.push_back(1);
 	break_points_map.push_back(std::move(break_point_locs));
 	break_points_records.push_back(std::make_pair(filename, line_no));
+	break_points_gdb.push_back(std::make_pair(-1, -1));
+	break_points_condition.push_back(d2x_break_condition());
+
+	return oss.str();
+}
+
+std::string get_cbreak(struct d2x_context ctx, const char* source_spec, const char* condition, std::ostream &output_command_file) {
+	std::stringstream oss;
+	prune_break_points();
+	std::string filename;
+	int line_no;
+	if (!parse_source_spec(ctx, source_spec, filename, line_no, oss))
+		return oss.str();
+
+	// Conditions are of the form <xvar> <op> <value>
+	struct d2x_break_condition cond;
+	static char varname_s[1024], op_s[8], value_s[1024];
+	if (sscanf(condition, "%1023s %7s %1023[^\n]", varname_s, op_s, value_s) != 3) {
+		oss << "Command requires a condition of the form <xvar> <op> <value>" << std::endl;
+		return oss.str();
+	}
+	cond.varname = varname_s;
+	cond.op = op_s;
+	cond.value = value_s;
+	if (cond.op != "==" && cond.op != "!=" && cond.op != "<" && cond.op != "<=" 
+		&& cond.op != ">" && cond.op != ">=") {
+		oss << "Unsupported operator " << cond.op << ", use one of ==, !=, <, <=, >, >=" << std::endl;
+		return oss.str();
+	}
+
+	// Only sections generated with hook points can evaluate conditions
+	break_locations_t all_locs = find_all_breaks(ctx, filename, line_no);
+	break_locations_t break_point_locs;
+	for (auto b: all_locs) {
+		if (b.first->flags & D2X_HEADER_HOOKS)
+			break_point_locs.push_back(b);
+	}
+	if (break_point_locs.size() != all_locs.size()) {
+		oss << "Warning: " << all_locs.size() - break_point_locs.size() << " locations were generated without hook points"
+			" and will not be checked" << std::endl;
+	}
+
+	int break_id = break_points_map.size();
+
+	// The conditions are evaluated in process and the inferior only stops in 
+	// d2x_hook_trap when one holds. Select the frame of the generated code in that case, it is 
+	// passed by address since the number of frames in between depends on the build
+	if (!hook_trap_installed && break_point_locs.size() != 0) {
+		output_command_file << "break d2x::runtime::d2x_hook_trap" << std::endl;
+		output_command_file << "commands" << std::endl;
+		output_command_file << "silent" << std::endl;
+		output_command_file << "printf \"Conditional breakpoint #%d hit\\n\", break_id" << std::endl;
+		output_command_file << "frame address frame_cfa" << std::endl;
+		output_command_file << "end" << std::endl;
+		hook_trap_installed = true;
+	}
+	oss << "Inserting conditional breakpoint with " << break_point_locs.size() << " hook points with ID: #" << break_id << std::endl;
+
+	break_points_status.push_back(1);
+	break_points_map.push_back(std::move(break_point_locs));
+	break_points_records.push_back(std::make_pair(filename, line_no));
+	break_points_gdb.push_back(std::make_pair(-1, -1));
+	break_points_condition.push_back(cond);
 
+	std::lock_guard<std::mutex> lock(hook_sites_mutex);
+	for (auto b: break_points_map[break_id]) {
+		struct d2x_hook_site &site = hook_sites[std::make_pair(b.first->function_addr, b.second)];
+		site.header = b.first;
+		site.break_ids.push_back(break_id);
+	}
+	publish_hook_sites();
 	return oss.str();
 }
 
-std::string get_del(struct d2x_context ctx, const char* source_spec, std::ostream &output_command_file) {
+static std::string get_del(struct d2x_context ctx, const char* source_spec, std::ostream &output_command_file) {
 	std::stringstream oss;
+	prune_break_points();
 	// There is only one type of inputs for del
 	// 1. Break point id of the form #id
 	std::string spec = source_spec;
@@ -631,13 +1715,29 @@ std::string get_del(struct d2x_context ctx, const char* source_spec, std::ostrea
 		oss << "Command requires a breakpoint id (#<id>). Run xbreak without any parameters to list all breakpoints" << std::endl;
 		return oss.str();
 	}
-	if (break_id < 0 || break_id >= break_points_records.size() || break_points_status[break_id] == 3) {
+	if (break_id < 0 || break_id >= (int)break_points_records.size() || break_points_status[break_id] == 3) {
 		oss << "ID #" << break_id << " is not a valid break point. Run xbreak without any parameters to list all breakpoints" << std::endl;
 		return oss.str();
 	}
 	
-	for (auto b: break_points_map[break_id]) {
-		output_command_file << "clear " << b.first << ":" << b.second << std::endl;
+	if (break_points_condition[break_id].varname != "") {
+		std::lock_guard<std::mutex> lock(hook_sites_mutex);
+		for (auto b: break_points_map[break_id]) {
+			auto it = hook_sites.find(std::make_pair(b.first->function_addr, b.second));
+			if (it == hook_sites.end())
+				continue;
+			auto &ids = it->second.break_ids;
+			ids.erase(std::remove(ids.begin(), ids.end(), break_id), ids.end());
+			if (ids.empty())
+				hook_sites.erase(it);
+		}
+		publish_hook_sites();
+	} else if (break_points_gdb[break_id].first != -1) {
+		output_command_file << "delete " << break_points_gdb[break_id].first << "-" << break_points_gdb[break_id].second << std::endl;
+	} else {
+		for (auto b: break_points_map[break_id]) {
+			output_command_file << "clear " << b.first->identified_filename << ":" << b.first->identified_line + b.second << std::endl;
+		}
 	}
 	oss << "Deleting " << break_points_map[break_id].size() << " breakpoints for ID: #" << break_id << std::endl;
 	break_points_status[break_id] = 3;
@@ -645,31 +1745,544 @@ std::string get_del(struct d2x_context ctx, const char* source_spec, std::ostrea
 	return oss.str();
 }
 
+static bool evaluate_condition(struct d2x_context &ctx, const struct d2x_break_condition &cond) {
+	const struct d2x_var_entry* var = find_var_entry(ctx, cond.varname.c_str());
+	if (var == nullptr)
+		return false;
+	bool more;
+	std::string value = render_var_value(ctx, var, 0, config_value_summary_len, &more);
+
+	// Compare numerically if both sides are numbers, otherwise compare the rendered strings
+	int cmp;
+	char *lhs_end, *rhs_end;
+	double lhs = strtod(value.c_str(), &lhs_end);
+	double rhs = strtod(cond.value.c_str(), &rhs_end);
+	if (value != "" && *lhs_end == 0 && cond.value != "" && *rhs_end == 0) 
+		cmp = (lhs < rhs) ? -1 : (lhs > rhs ? 1 : 0);
+	else
+		cmp = value.compare(cond.value);
+
+	if (cond.op == "==") return cmp == 0;
+	if (cond.op == "!=") return cmp != 0;
+	if (cond.op == "<") return cmp < 0;
+	if (cond.op == "<=") return cmp <= 0;
+	if (cond.op == ">") return cmp > 0;
+	if (cond.op == ">=") return cmp >= 0;
+	return false;
+}
+
+// Kept out of line so the debugger has a fixed place to stop when a condition holds
+void __attribute__((noinline)) d2x_hook_trap(int break_id, unsigned long long frame_cfa);
+void __attribute__((noinline)) d2x_hook_trap(int break_id, unsigned long long frame_cfa) {
+	// Keep the arguments live, the debugger reads them here
+	asm volatile("" : : "r"(break_id), "r"(frame_cfa));
+}
+
+static void run_hook(unsigned long long function_addr, int line, unsigned long long caller_sp) {
+	if (hook_sites_generation != registry_removals) {
+		std::lock_guard<std::mutex> lock(hook_sites_mutex);
+		prune_hook_sites();
+	}
+	const hook_snapshot_t* snapshot = hook_snapshot.load(std::memory_order_acquire);
+	if (snapshot == nullptr)
+		return;
+	auto it = snapshot->find(std::make_pair(function_addr, line));
+	if (it == snapshot->end())
+		return;
+	d2x_function_header* header = it->second.header;
+
+	// Recover the registers of the generated code that invoked the hook. Frames of the core 
+	// forwarder are skipped, the generated code is the frame whose sp the core passed
+	unw_context_t context;
+	unw_cursor_t cursor;
+	unw_getcontext(&context);
+	unw_init_local(&cursor, &context);
+	unw_word_t ip, sp, bp, bx;
+	do {
+		if (unw_step(&cursor) <= 0)
+			return;
+		unw_get_reg(&cursor, UNW_REG_SP, &sp);
+	} while (sp < caller_sp);
+	if (sp != caller_sp)
+		return;
+	unw_get_reg(&cursor, UNW_REG_IP, &ip);
+	unw_get_reg(&cursor, UNW_X86_64_RBP, &bp);
+	unw_get_reg(&cursor, UNW_X86_64_RBX, &bx);
+
+	// The frame address the debugger knows the generated code by is its CFA, the sp of its caller
+	unw_cursor_t caller = cursor;
+	unw_word_t frame_cfa = 0;
+	if (unw_step(&caller) > 0)
+		unw_get_reg(&caller, UNW_REG_SP, &frame_cfa);
+
+	struct d2x_context ctx = find_context((void*)ip, (void*)sp, (void*)bp, (void*)bx);
+	// The hook site already tells us the exact section and line
+	ctx.header = header;
+	ctx.function_line = header->identified_line;
+	ctx.address_line = ctx.function_line + line;
+
+	for (auto &check: it->second.checks) {
+		if (evaluate_condition(ctx, check.cond))
+			d2x_hook_trap(check.break_id, frame_cfa);
+	}
+}
+
+// DSL level stepping. Temporary breakpoints are placed on the first generated line of every DSL 
+// statement of the current section whose depth matches the mode, and on the return from the 
+// generated function. The current statement is included, since it is only reached again when it 
+// is re-entered, e.g. by the next iteration of a loop. The inferior is then continued once
+std::string get_step(struct d2x_context ctx, const char* mode, std::ostream &output_command_file) {
+	std::stringstream oss;
+	if (ctx.header == nullptr || ctx.address_line == -1 || ctx.function_line == -1) {
+		oss << "Cannot identify extended stack information for current location, aborting!" << std::endl;
+		return oss.str();
+	}
+	int line_offset = ctx.address_line - ctx.function_line;
+	d2x_function_header* header = ctx.header;
+	struct d2x_source_loc *locs = header->source_list;
+	const char** string_table = header->string_table;
+
+	struct d2x_source_stack current = header->source_table[line_offset];
+	if (current.stack_size == 0) {
+		oss << "Cannot identify extended stack information for current location, aborting!" << std::endl;
+		return oss.str();
+	}
 
-void print_output(std::string s) {
+	std::vector<int> targets;
+	const char* prev_filename = nullptr;
+	int prev_linenumber = -1;
+	for (int line_no = 0; line_no < header->source_table_len; line_no++) {
+		struct d2x_source_stack stack = header->source_table[line_no];
+		if (stack.stack_size == 0) {
+			prev_filename = nullptr;
+			continue;
+		}
+		struct d2x_source_loc top = locs[stack.stack_offset];
+		const char* filename = string_table[top.filename];
+		// Only the first of consecutive lines with the same top needs a stop
+		bool run_start = prev_filename == nullptr || prev_linenumber != top.linenumber 
+			|| strcmp(prev_filename, filename) != 0;
+		prev_filename = filename;
+		prev_linenumber = top.linenumber;
+		if (!run_start)
+			continue;
+		bool matches;
+		if (strcmp(mode, "next") == 0)
+			matches = stack.stack_size <= current.stack_size;
+		else if (strcmp(mode, "finish") == 0)
+			matches = stack.stack_size < current.stack_size;
+		else
+			matches = true;
+		if (matches)
+			targets.push_back(line_no);
+	}
+
+	uint64_t return_ip = 0, frame_cfa = 0;
+	unwind_frame(ctx, &return_ip, &frame_cfa);
+
+	if (targets.empty() && return_ip == 0) {
+		oss << "No DSL location to stop at" << std::endl;
+		return oss.str();
+	}
+
+	// For next and finish, lines reached in deeper recursive instances of the function are 
+	// skipped. Their stack is below the current stack pointer, lines of this frame are at or above it
+	std::stringstream guard;
+	if (strcmp(mode, "step") != 0)
+		guard << " if $sp >= " << (void*)ctx.rsp;
+	bool first = true;
+	for (auto line_no: targets) {
+		output_command_file << "break " << header->identified_filename << ":" << header->identified_line + line_no 
+			<< guard.str() << std::endl;
+		if (first)
+			output_command_file << "set $d2x_step_first = $bpnum" << std::endl;
+		first = false;
+	}
+	if (return_ip != 0) {
+		output_command_file << "break *" << (void*)return_ip << " if $sp >= " << (void*)frame_cfa << std::endl;
+		if (first)
+			output_command_file << "set $d2x_step_first = $bpnum" << std::endl;
+	}
+	output_command_file << "continue" << std::endl;
+	output_command_file << "delete $d2x_step_first-$bpnum" << std::endl;
+	output_command_file << "xframe" << std::endl;
+	return oss.str();
+}
+
+// Results for tools are also available as length prefixed records in a buffer owned by the runtime,
+// so they don't have to be scraped from the inferior's stdout. The buffer holds
+//	"D2XR", uint32 version, uint32 size in bytes including this header, uint32 number of records
+// followed by the records
+//	uint32 type (D2X_RECORD_*), uint32 payload size, payload
+// Integers are 32 bit in native byte order, strings are a uint32 length followed by the bytes.
+// The buffer stays valid until the next call returning records on the same thread
+class record_writer {
+	std::vector<char> &buffer;
+	size_t record_start = 0;
+	uint32_t records = 0;
+	void put(const void* data, size_t size) {
+		buffer.insert(buffer.end(), (const char*) data, (const char*) data + size);
+	}
+	void patch(size_t at, uint32_t value) {
+		memcpy(&buffer[at], &value, sizeof(value));
+	}
+public:
+	record_writer(std::vector<char> &buffer): buffer(buffer) {
+		buffer.clear();
+		put("D2XR", 4);
+		uint32_t header[3] = {D2X_RECORD_VERSION, 0, 0};
+		put(header, sizeof(header));
+	}
+	void begin(uint32_t type) {
+		uint32_t header[2] = {type, 0};
+		record_start = buffer.size();
+		put(header, sizeof(header));
+	}
+	void end(void) {
+		patch(record_start + 4, buffer.size() - record_start - 8);
+		records++;
+	}
+	void put_int(int32_t value) {
+		put(&value, sizeof(value));
+	}
+	void put_string(const std::string &value) {
+		uint32_t len = value.size();
+		put(&len, sizeof(len));
+		put(value.c_str(), value.size());
+	}
+	const char* finish(void) {
+		patch(8, buffer.size());
+		patch(12, records);
+		return buffer.data();
+	}
+};
+static thread_local std::vector<char> record_buffer;
+
+const char* get_backtrace_records(struct d2x_context ctx) {
+	record_writer writer(record_buffer);
+	std::vector<struct d2x_frame_info> frames = collect_backtrace(ctx);
+	for (int i = 0; i < (int) frames.size(); i++) {
+		writer.begin(D2X_RECORD_FRAME);
+		writer.put_int(i);
+		writer.put_string(frames[i].function);
+		writer.put_int(frames[i].foffset);
+		writer.put_string(frames[i].filename);
+		writer.put_int(frames[i].line);
+		writer.end();
+	}
+	return writer.finish();
+}
+
+const char* get_vars_records(struct d2x_context ctx) {
+	record_writer writer(record_buffer);
+	for (auto &var: collect_vars(ctx, true)) {
+		writer.begin(D2X_RECORD_VAR);
+		writer.put_string(var.name);
+		writer.put_string(var.value);
+		writer.put_int(var.truncated);
+		writer.end();
+	}
+	return writer.finish();
+}
+
+const char* get_break_records(void) {
+	record_writer writer(record_buffer);
+	prune_break_points();
+	for (auto &b: collect_breaks()) {
+		writer.begin(D2X_RECORD_BREAK);
+		writer.put_int(b.id);
+		writer.put_int(b.status);
+		writer.put_string(b.filename);
+		writer.put_int(b.line);
+		writer.put_string(b.condition);
+		writer.put_int(b.locations);
+		writer.end();
+	}
+	return writer.finish();
+}
+
+static void print_output(std::string s) {
 	std::cout << s;
 }
 
-/* API functions to be invoked from the debugger */
-namespace cmd {
-void xbt(void* ip, void* sp, void* bp, void* bx) {
+/* Introspection server. Threads are sampled together: the server gives every thread a sample
+slot and signals them all, each handler unwinds the interrupted stack into the slot it owns and
+returns. Only the handler runs in the sampled threads, all lookups are done on the server 
+thread afterwards. The handler only uses libunwind local unwinding and atomics, which are async 
+signal safe. Slots are static so a late handler never touches freed memory, processes with more
+threads than slots are sampled in batches */
+#define D2X_INTROSPECT_MAX_FRAMES 128
+#define D2X_INTROSPECT_MAX_THREADS 256
+// How long to wait for the threads of a batch to run their handlers, threads blocked with the 
+// signal masked never do
+static int config_introspect_timeout_ms = 100;
+
+struct d2x_thread_sample {
+	// tid of the thread that may fill the slot, -1 once its handler has claimed it
+	std::atomic<int> owner;
+	std::atomic<int> done;
+	int num_frames;
+	uint64_t ips[D2X_INTROSPECT_MAX_FRAMES];
+};
+static struct d2x_thread_sample thread_samples[D2X_INTROSPECT_MAX_THREADS];
+static int introspect_signal = -1;
+static std::mutex introspect_mutex;
+
+static void introspect_handler(int sig, siginfo_t* info, void* ucontext) {
+	int tid = syscall(SYS_gettid);
+	struct d2x_thread_sample* sample = nullptr;
+	for (int i = 0; i < D2X_INTROSPECT_MAX_THREADS && sample == nullptr; i++) {
+		int expected = tid;
+		if (thread_samples[i].owner.compare_exchange_strong(expected, -1))
+			sample = &thread_samples[i];
+	}
+	if (sample == nullptr)
+		return;
+	int saved_errno = errno;
+	unw_cursor_t cursor;
+	int n = 0;
+	if (unw_init_local2(&cursor, (unw_context_t*) ucontext, UNW_INIT_SIGNAL_FRAME) == 0) {
+		do {
+			unw_word_t ip;
+			unw_get_reg(&cursor, UNW_REG_IP, &ip);
+			sample->ips[n++] = ip;
+		} while (n < D2X_INTROSPECT_MAX_FRAMES && unw_step(&cursor) > 0);
+	}
+	sample->num_frames = n;
+	sample->done.store(1, std::memory_order_release);
+	errno = saved_errno;
+}
+
+// Native IPs of each thread in tids, innermost first. Threads that did not respond in time are
+// added to unresponsive instead
+static void sample_threads(const std::vector<int> &tids, std::map<int, std::vector<uint64_t>> &samples, 
+		std::set<int> &unresponsive) {
+	for (size_t first = 0; first < tids.size(); first += D2X_INTROSPECT_MAX_THREADS) {
+		size_t count = std::min<size_t>(tids.size() - first, D2X_INTROSPECT_MAX_THREADS);
+		for (size_t i = 0; i < count; i++) {
+			struct d2x_thread_sample &sample = thread_samples[i];
+			sample.num_frames = 0;
+			sample.done.store(0);
+			sample.owner.store(tids[first + i]);
+			if (syscall(SYS_tgkill, getpid(), tids[first + i], introspect_signal) != 0)
+				sample.owner.store(0);
+		}
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(config_introspect_timeout_ms);
+		for (size_t i = 0; i < count; i++) {
+			struct d2x_thread_sample &sample = thread_samples[i];
+			int tid = tids[first + i];
+			// The slot was released right away if the signal could not be sent
+			bool responded = sample.owner.load() != 0;
+			while (responded && !sample.done.load(std::memory_order_acquire)) {
+				if (std::chrono::steady_clock::now() > deadline) {
+					// The handler may have claimed the slot just now, then it finishes shortly
+					int expected = tid;
+					if (sample.owner.compare_exchange_strong(expected, 0)) {
+						responded = false;
+						break;
+					}
+				}
+				std::this_thread::yield();
+			}
+			if (responded)
+				samples[tid].assign(sample.ips, sample.ips + sample.num_frames);
+			else {
+				samples[tid].clear();
+				unresponsive.insert(tid);
+			}
+		}
+	}
+}
+
+static std::string thread_name(int tid) {
+	std::ifstream comm("/proc/self/task/" + std::to_string(tid) + "/comm");
+	std::string name;
+	std::getline(comm, name);
+	return name;
+}
+
+// One line per DSL frame at ip, innermost first
+static std::string dsl_frames(unsigned long long ip) {
+	std::stringstream oss;
+	struct d2x_context ctx = find_context((void*) ip, nullptr, nullptr, nullptr);
+	for (auto &frame: collect_backtrace(ctx)) {
+		oss << frame.function;
+		if (frame.foffset != -1)
+			oss << ":" << frame.foffset;
+		oss << " at " << basename(frame.filename) << ":" << frame.line << "\n";
+	}
+	return oss.str();
+}
+
+static std::string get_all_thread_stacks(void) {
+	std::lock_guard<std::mutex> lock(introspect_mutex);
+	std::vector<int> tids;
+	DIR* dir = opendir("/proc/self/task");
+	if (dir == nullptr)
+		return "Failed to list threads\n";
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != nullptr) {
+		if (entry->d_name[0] != '.')
+			tids.push_back(atoi(entry->d_name));
+	}
+	closedir(dir);
+	int self = syscall(SYS_gettid);
+
+	// Sample everything first so threads are interrupted close together
+	tids.erase(std::remove(tids.begin(), tids.end(), self), tids.end());
+	std::map<int, std::vector<uint64_t>> samples;
+	std::set<int> unresponsive;
+	sample_threads(tids, samples, unresponsive);
+
+	std::stringstream oss;
+	for (auto &s: samples) {
+		oss << "Thread " << s.first << " (" << thread_name(s.first) << "):\n";
+		if (unresponsive.count(s.first)) {
+			oss << "\t(did not respond)\n";
+			continue;
+		}
+		int index = 0;
+		for (int i = 0; i < (int) s.second.size(); i++) {
+			// Return addresses point after the call
+			uint64_t ip = i == 0 ? s.second[i] : s.second[i] - 1;
+			std::stringstream frames(dsl_frames(ip));
+			std::string frame;
+			while (std::getline(frames, frame))
+				oss << "\t#" << index++ << " in " << frame << "\n";
+		}
+		if (index == 0)
+			oss << "\t(no DSL frames)\n";
+	}
+	return oss.str();
+}
+
+static void serve_introspection(int server_fd) {
+	while (true) {
+		int fd = accept(server_fd, nullptr, nullptr);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		std::string output = get_all_thread_stacks();
+		size_t sent = 0;
+		while (sent < output.size()) {
+			ssize_t ret = write(fd, output.c_str() + sent, output.size() - sent);
+			if (ret <= 0)
+				break;
+			sent += ret;
+		}
+		close(fd);
+	}
+}
+
+static int run_introspection_server(const char* socket_path) {
+	std::lock_guard<std::mutex> lock(introspect_mutex);
+	if (introspect_signal != -1)
+		return 0;
+	struct sockaddr_un addr;
+	if (strlen(socket_path) >= sizeof(addr.sun_path))
+		return -1;
+	int sig = SIGRTMIN + 4;
+	const char* sig_env = getenv("D2X_INTROSPECT_SIGNAL");
+	if (sig_env != nullptr)
+		sig = atoi(sig_env);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = introspect_handler;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(sig, &sa, nullptr) != 0)
+		return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+	// Only a stale socket is replaced, never a file that happens to be at the path
+	struct stat st;
+	if (lstat(socket_path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			close(fd);
+			return -1;
+		}
+		unlink(socket_path);
+	}
+	// Stacks are only for the owner. Connections are refused until listen, so the socket is
+	// never reachable with the mode bind gave it
+	if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || chmod(socket_path, 0600) != 0 
+			|| listen(fd, 4) != 0) {
+		close(fd);
+		return -1;
+	}
+	introspect_signal = sig;
+	// The server thread must never be sampled itself
+	sigset_t mask, old_mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, sig);
+	pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+	std::thread(serve_introspection, fd).detach();
+	pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+	return 0;
+}
+
+/* API functions invoked from the debugger through the core runtime */
+namespace backend {
+static void xbudget(long long time_ms, long long output_bytes) {
+	if (time_ms >= 0)
+		config_resolver_time_budget_ms = time_ms;
+	if (output_bytes >= 0)
+		config_resolver_output_budget = output_bytes;
+	std::stringstream oss;
+	oss << "Resolver time budget: ";
+	if (config_resolver_time_budget_ms == 0)
+		oss << "unlimited\n";
+	else
+		oss << config_resolver_time_budget_ms << " ms\n";
+	oss << "Resolver output budget: ";
+	if (config_resolver_output_budget == 0)
+		oss << "unlimited\n";
+	else
+		oss << config_resolver_output_budget << " bytes per page\n";
+	print_output(oss.str());
+}
+static void xbt(void* ip, void* sp, void* bp, void* bx) {
 	print_output(get_backtrace(find_context(ip, sp, bp, bx)));
 }
-void xlist(void* ip, void* sp, void* bp, void* bx) {	
+static void xlist(void* ip, void* sp, void* bp, void* bx) {	
 	print_output(get_listing(find_context(ip, sp, bp, bx)));
 }
-void xframe(void* ip, void* sp, void* bp, void* bx, const char* update) {
+static void xframe(void* ip, void* sp, void* bp, void* bx, const char* update) {
 	print_output(get_frame(find_context(ip, sp, bp, bx), update));
 }
-void xvars(void* ip, void* sp, void* bp, void* bx, const char* varname) {
+static void xvars(void* ip, void* sp, void* bp, void* bx, const char* varname) {
 	print_output(get_vars(find_context(ip, sp, bp, bx), varname));
 }
-void xfvl(void* ip, void* sp, void* bp, void* bx, const char* varname) {
+static void xfvl(void* ip, void* sp, void* bp, void* bx, const char* varname) {
 	print_output(get_fvl(find_context(ip, sp, bp, bx), varname));
 }
+static void xvalue(void* ip, void* sp, void* bp, void* bx, const char* varname, unsigned long long offset, unsigned long long len) {
+	print_output(get_value(find_context(ip, sp, bp, bx), varname, offset, len));
+}
+static long long xvalue_chunk(void* ip, void* sp, void* bp, void* bx, const char* varname, char* buffer, 
+		unsigned long long offset, unsigned long long len) {
+	return get_value_chunk(find_context(ip, sp, bp, bx), varname, buffer, offset, len);
+}
+static const char* xbt_records(void* ip, void* sp, void* bp, void* bx) {
+	return get_backtrace_records(find_context(ip, sp, bp, bx));
+}
+static const char* xvars_records(void* ip, void* sp, void* bp, void* bx) {
+	return get_vars_records(find_context(ip, sp, bp, bx));
+}
+static const char* xbreak_records(void) {
+	return get_break_records();
+}
 // xbreak generates a command sequence to be executed besides the output
 static char ret_command_buffer[1024];
-const char* xbreak(void* ip, void* sp, void* bp, void* bx, const char* source_spec) {
+static const char* xbreak(void* ip, void* sp, void* bp, void* bx, const char* source_spec) {
 	const char* filename = ".d2x.commands";	
 	std::ofstream output_file;
 	output_file.open(filename);			
@@ -680,7 +2293,46 @@ const char* xbreak(void* ip, void* sp, void* bp, void* bx, const char* source_sp
 	sprintf(ret_command_buffer, "source %s", filename);
 	return ret_command_buffer;
 }
-const char* xdel(void* ip, void* sp, void* bp, void* bx, const char* source_spec) {
+// Invoked from the command file generated by xbreak to record the gdb breakpoints created for an ID
+static void xbreak_bind(int break_id, int first_bp, int last_bp) {
+	if (break_id < 0 || break_id >= (int)break_points_gdb.size())
+		return;
+	break_points_gdb[break_id] = std::make_pair(first_bp, last_bp);
+}
+static const char* xcbreak(void* ip, void* sp, void* bp, void* bx, const char* source_spec, const char* condition) {
+	const char* filename = ".d2x.commands";	
+	std::ofstream output_file;
+	output_file.open(filename);			
+	print_output(get_cbreak(find_context(ip, sp, bp, bx), source_spec, condition, output_file));
+	// Clean up the command file after it executes
+	output_file << std::endl << "shell rm -f " << filename << std::endl;
+	output_file.close();
+	sprintf(ret_command_buffer, "source %s", filename);
+	return ret_command_buffer;
+}
+static const char* xwatch(void* ip, void* sp, void* bp, void* bx, const char* varname) {
+	const char* filename = ".d2x.commands";	
+	std::ofstream output_file;
+	output_file.open(filename);			
+	print_output(get_watch(find_context(ip, sp, bp, bx), varname, output_file));
+	// Clean up the command file after it executes
+	output_file << std::endl << "shell rm -f " << filename << std::endl;
+	output_file.close();
+	sprintf(ret_command_buffer, "source %s", filename);
+	return ret_command_buffer;
+}
+static const char* xstep(void* ip, void* sp, void* bp, void* bx, const char* mode) {
+	const char* filename = ".d2x.commands";	
+	std::ofstream output_file;
+	output_file.open(filename);			
+	print_output(get_step(find_context(ip, sp, bp, bx), mode, output_file));
+	// Clean up the command file after it executes
+	output_file << std::endl << "shell rm -f " << filename << std::endl;
+	output_file.close();
+	sprintf(ret_command_buffer, "source %s", filename);
+	return ret_command_buffer;
+}
+static const char* xdel(void* ip, void* sp, void* bp, void* bx, const char* source_spec) {
 	const char* filename = ".d2x.commands";	
 	std::ofstream output_file;
 	output_file.open(filename);			
@@ -692,6 +2344,46 @@ const char* xdel(void* ip, void* sp, void* bp, void* bx, const char* source_spec
 	return ret_command_buffer;
 }
 }
+
+static const struct d2x_backend_ops backend_ops = {
+	D2X_BACKEND_VERSION,
+	add_header,
+	remove_header,
+	add_jit_elf_module,
+	add_jit_line_table_module,
+	remove_jit_module,
+	run_hook,
+	rtv_find_stack_var,
+	rtv_sink_write,
+	rtv_sink_full,
+	rtv_budget_exhausted,
+	backend::xbt,
+	backend::xlist,
+	backend::xframe,
+	backend::xvars,
+	backend::xfvl,
+	backend::xvalue,
+	backend::xvalue_chunk,
+	backend::xbreak,
+	backend::xbreak_bind,
+	backend::xbt_records,
+	backend::xvars_records,
+	backend::xbreak_records,
+	backend::xwatch,
+	backend::xstep,
+	backend::xcbreak,
+	backend::xdel,
+	backend::xbudget,
+	run_introspection_server,
+	dsl_frames,
+};
+
 }
 }
 
+const struct d2x::runtime::d2x_backend_ops* d2x_backend_init(const struct d2x::runtime::d2x_core_ops* core) {
+	if (core->version != D2X_BACKEND_VERSION)
+		return nullptr;
+	d2x::runtime::core = core;
+	return &d2x::runtime::backend_ops;
+}
@@ -0,0 +1,539 @@
+#include "d2x_runtime/d2x_runtime_core.h"
+#include "d2x_backend.h"
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <map>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+
+namespace d2x {
+namespace runtime {
+
+// All registered headers, including those of JIT code, and the JIT code ranges. Registration 
+// is forwarded to the backend once it is loaded. Until then JIT registrations are kept here 
+// so they can be replayed. Allocated on first use and never freed since registration runs 
+// from static constructors and destructors
+struct d2x_jit_registration {
+	std::string name;
+	const void* load_base;
+	const void* code_begin;
+	const void* code_end;
+	std::vector<char> elf_image;
+	std::vector<struct d2x_line_entry> lines;
+	std::vector<std::string> files;
+	std::vector<d2x_function_header*> headers;
+};
+static std::vector<d2x_function_header*> *registered_headers = nullptr;
+static std::map<uint64_t, uint64_t> *jit_ranges = nullptr;
+static std::vector<struct d2x_jit_registration> *pending_jit_registrations = nullptr;
+static std::mutex core_mutex;
+
+static std::atomic<const struct d2x_backend_ops*> backend(nullptr);
+
+volatile int d2x_hooks_enabled = 0;
+
+// Rings of all live threads that recorded history. Protected by the core_mutex
+static std::vector<struct d2x_history_ring*> *history_rings = nullptr;
+static int history_thread_counter = 0;
+thread_local struct d2x_history_ring* d2x_history_thread_ring = nullptr;
+
+static const struct d2x_core_ops core_ops = {
+	D2X_BACKEND_VERSION,
+	&d2x_hooks_enabled,
+};
+
+// Should be called with the core_mutex held
+static void core_init(void) {
+	if (registered_headers == nullptr) {
+		registered_headers = new std::vector<d2x_function_header*>();
+		jit_ranges = new std::map<uint64_t, uint64_t>();
+		pending_jit_registrations = new std::vector<struct d2x_jit_registration>();
+		history_rings = new std::vector<struct d2x_history_ring*>();
+	}
+}
+
+// Counts of sections whose module was unloaded, keyed like the live counts below.
+// Protected by the core_mutex
+static std::map<std::string, unsigned long long> *retired_line_counts = nullptr;
+static std::map<std::string, unsigned long long> *retired_stack_counts = nullptr;
+
+static void accumulate_line_counts(d2x_function_header* header, std::map<std::string, unsigned long long> &line_counts,
+		std::map<std::string, unsigned long long> &stack_counts) {
+	if (header->counters == nullptr)
+		return;
+	struct d2x_source_loc *locs = header->source_list;
+	const char** string_table = header->string_table;
+	for (int line_no = 0; line_no < header->source_table_len; line_no++) {
+		unsigned long long count = __atomic_load_n(&header->counters[line_no].count, __ATOMIC_RELAXED);
+		struct d2x_source_stack stack = header->source_table[line_no];
+		if (count == 0 || stack.stack_size == 0)
+			continue;
+		std::stringstream top, frames;
+		for (int i = 0; i < stack.stack_size; i++) {
+			struct d2x_source_loc loc = locs[i + stack.stack_offset];
+			if (i == 0) 
+				top << string_table[loc.filename] << ":" << loc.linenumber;
+			else
+				frames << ";";
+			frames << string_table[loc.function] << "@" << string_table[loc.filename] << ":" << loc.linenumber;
+		}
+		line_counts[top.str()] += count;
+		stack_counts[frames.str()] += count;
+	}
+}
+
+// Should be called with the core_mutex held
+static void retire_line_counts(d2x_function_header* h) {
+	if (h->counters == nullptr)
+		return;
+	if (retired_line_counts == nullptr) {
+		retired_line_counts = new std::map<std::string, unsigned long long>();
+		retired_stack_counts = new std::map<std::string, unsigned long long>();
+	}
+	accumulate_line_counts(h, *retired_line_counts, *retired_stack_counts);
+}
+
+// Aggregates the line counters of all sections by DSL file:line (top of the extended stack)
+// and by full extended stack
+std::string get_line_counts(void) {
+	std::map<std::string, unsigned long long> line_counts;
+	std::map<std::string, unsigned long long> stack_counts;
+	{
+		// Holding the lock keeps modules from being unloaded while their counters are read
+		std::lock_guard<std::mutex> lock(core_mutex);
+		core_init();
+		if (retired_line_counts != nullptr) {
+			line_counts = *retired_line_counts;
+			stack_counts = *retired_stack_counts;
+		}
+		for (auto header: *registered_headers)
+			accumulate_line_counts(header, line_counts, stack_counts);
+	}
+	std::stringstream oss;
+	for (auto &l: line_counts)
+		oss << "line\t" << l.first << "\t" << l.second << "\n";
+	for (auto &l: stack_counts) 
+		oss << "stack\t" << l.first << "\t" << l.second << "\n";
+	return oss.str();
+}
+
+static void write_line_counts(const char* filename) {
+	if (filename == nullptr || strcmp(filename, "") == 0) {
+		std::cout << get_line_counts();
+		return;
+	}
+	std::ofstream output_file;
+	output_file.open(filename);
+	output_file << get_line_counts();
+	output_file.close();
+}
+
+// Dumps the counters at exit if D2X_LINE_COUNTS is set to a filename
+struct d2x_line_counts_at_exit {
+	~d2x_line_counts_at_exit() {
+		const char* filename = getenv("D2X_LINE_COUNTS");
+		if (filename != nullptr)
+			write_line_counts(filename);
+	}
+};
+static struct d2x_line_counts_at_exit line_counts_at_exit;
+
+std::string get_dsl_frames(unsigned long long ip) {
+	if (load_backend())
+		return "";
+	return backend.load()->dsl_frames(ip);
+}
+
+int start_introspection_server(const char* socket_path) {
+	if (load_backend())
+		return -1;
+	return backend.load()->start_introspection_server(socket_path);
+}
+
+// Starts the introspection server at startup if D2X_INTROSPECT_SOCKET is set
+struct d2x_introspection_at_start {
+	d2x_introspection_at_start() {
+		const char* path = getenv("D2X_INTROSPECT_SOCKET");
+		if (path == nullptr)
+			return;
+		std::string socket_path = path;
+		size_t pos = socket_path.find("%p");
+		if (pos != std::string::npos)
+			socket_path.replace(pos, 2, std::to_string(getpid()));
+		start_introspection_server(socket_path.c_str());
+	}
+};
+static struct d2x_introspection_at_start introspection_at_start;
+
+// Frees the ring of a thread when it exits
+struct d2x_history_owner {
+	struct d2x_history_ring* ring = nullptr;
+	~d2x_history_owner() {
+		if (ring == nullptr)
+			return;
+		std::lock_guard<std::mutex> lock(core_mutex);
+		history_rings->erase(std::remove(history_rings->begin(), history_rings->end(), ring), history_rings->end());
+		d2x_history_thread_ring = nullptr;
+		delete ring;
+	}
+};
+static thread_local struct d2x_history_owner history_owner;
+
+struct d2x_history_ring* d2x_history_init_thread(void) {
+	struct d2x_history_ring* ring = new struct d2x_history_ring();
+	{
+		std::lock_guard<std::mutex> lock(core_mutex);
+		core_init();
+		ring->thread_index = history_thread_counter++;
+		history_rings->push_back(ring);
+	}
+	history_owner.ring = ring;
+	d2x_history_thread_ring = ring;
+	return ring;
+}
+
+// Decodes an entry through the section's tables. Returns false if the section is gone or 
+// the var is not live at the recorded line. Should be called with the core_mutex held
+static bool decode_history_entry(const struct d2x_history_entry &e, const char* varname, std::ostream &oss) {
+	d2x_function_header* header = nullptr;
+	for (auto h: *registered_headers) {
+		if (h->function_addr == e.function_addr) {
+			header = h;
+			break;
+		}
+	}
+	if (header == nullptr || e.line < 0 || e.line >= header->source_table_len 
+			|| e.varname < 0 || e.varname >= header->string_table_len)
+		return false;
+	const char** string_table = header->string_table;
+	if (strcmp(string_table[e.varname], varname) != 0)
+		return false;
+	struct d2x_var_stack vars = header->var_table[e.line];
+	bool live = false;
+	for (int i = 0; i < vars.stack_size; i++) 
+		live = live || header->var_list[vars.stack_offset + i].varname == e.varname;
+	if (!live)
+		return false;
+	struct d2x_source_stack stack = header->source_table[e.line];
+	if (stack.stack_size > 0) {
+		struct d2x_source_loc loc = header->source_list[stack.stack_offset];
+		oss << string_table[loc.filename] << ":" << loc.linenumber << " in " << string_table[loc.function];
+	} else 
+		oss << header->identified_filename << ":" << header->identified_line + e.line;
+	oss << " " << varname << " = ";
+	if (e.is_float)
+		oss << e.value.f;
+	else
+		oss << e.value.i;
+	return true;
+}
+
+std::string get_history(const char* varname, int count) {
+	std::stringstream oss;
+	std::lock_guard<std::mutex> lock(core_mutex);
+	core_init();
+	for (auto ring: *history_rings) {
+		unsigned long long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		unsigned long long available = std::min(head, (unsigned long long) D2X_HISTORY_SIZE);
+		int found = 0;
+		for (unsigned long long i = 0; i < available && found < count; i++) {
+			const struct d2x_history_entry &e = ring->entries[(head - 1 - i) % D2X_HISTORY_SIZE];
+			std::stringstream entry;
+			if (!decode_history_entry(e, varname, entry))
+				continue;
+			if (found == 0)
+				oss << "Thread " << ring->thread_index << ":\n";
+			oss << "#" << found << " " << entry.str() << "\n";
+			found++;
+		}
+	}
+	if (oss.str() == "")
+		oss << "No history recorded for " << varname << "\n";
+	return oss.str();
+}
+
+// Should be called with the core_mutex held
+static void add_registered_header(d2x_function_header* h) {
+	if (std::find(registered_headers->begin(), registered_headers->end(), h) == registered_headers->end())
+		registered_headers->push_back(h);
+}
+
+void register_header(struct d2x_function_header *h) {
+	std::lock_guard<std::mutex> lock(core_mutex);
+	core_init();
+	add_registered_header(h);
+	if (backend != nullptr)
+		backend.load()->register_header(h);
+}
+
+void unregister_header(struct d2x_function_header *h) {
+	std::lock_guard<std::mutex> lock(core_mutex);
+	core_init();
+	auto it = std::find(registered_headers->begin(), registered_headers->end(), h);
+	if (it == registered_headers->end())
+		return;
+	registered_headers->erase(it);
+	// Counters would go away with the module
+	retire_line_counts(h);
+	if (backend != nullptr)
+		backend.load()->unregister_header(h);
+}
+
+// Should be called with the core_mutex held
+static bool add_jit_range(const void* code_begin, const void* code_end) {
+	uint64_t begin = (uint64_t) code_begin, end = (uint64_t) code_end;
+	if (begin >= end)
+		return false;
+	auto next = jit_ranges->lower_bound(begin);
+	if (next != jit_ranges->end() && next->first < end)
+		return false;
+	if (next != jit_ranges->begin() && std::prev(next)->second > begin)
+		return false;
+	(*jit_ranges)[begin] = end;
+	return true;
+}
+
+int register_jit_module(const char* name, const void* load_base, const void* code_begin, const void* code_end, 
+		const void* elf_image, size_t elf_size, struct d2x_function_header** headers, int num_headers) {
+	std::lock_guard<std::mutex> lock(core_mutex);
+	core_init();
+	if (backend != nullptr) {
+		if (backend.load()->register_jit_module(name, load_base, code_begin, code_end, elf_image, elf_size, headers, num_headers))
+			return -1;
+		add_jit_range(code_begin, code_end);
+	} else {
+		if (!add_jit_range(code_begin, code_end))
+			return -1;
+		struct d2x_jit_registration r;
+		r.name = name;
+		r.load_base = load_base;
+		r.code_begin = code_begin;
+		r.code_end = code_end;
+		r.elf_image.assign((const char*) elf_image, (const char*) elf_image + elf_size);
+		r.headers.assign(headers, headers + num_headers);
+		pending_jit_registrations->push_back(std::move(r));
+	}
+	for (int i = 0; i < num_headers; i++)
+		add_registered_header(headers[i]);
+	return 0;
+}
+
+int register_jit_line_table(const char* name, const void* load_base, const void* code_begin, const void* code_end, 
+		const struct d2x_line_entry* lines, int num_lines, const char** files, int num_files, 
+		struct d2x_function_header** headers, int num_headers) {
+	std::lock_guard<std::mutex> lock(core_mutex);
+	core_init();
+	if (backend != nullptr) {
+		if (backend.load()->register_jit_line_table(name, load_base, code_begin, code_end, lines, num_lines, 
+				files, num_files, headers, num_headers))
+			return -1;
+		add_jit_range(code_begin, code_end);
+	} else {
+		if (!add_jit_range(code_begin, code_end))
+			return -1;
+		struct d2x_jit_registration r;
+		r.name = name;
+		r.load_base = load_base;
+		r.code_begin = code_begin;
+		r.code_end = code_end;
+		r.lines.assign(lines, lines + num_lines);
+		r.files.assign(files, files + num_files);
+		r.headers.assign(headers, headers + num_headers);
+		pending_jit_registrations->push_back(std::move(r));
+	}
+	for (int i = 0; i < num_headers; i++)
+		add_registered_header(headers[i]);
+	return 0;
+}
+
+void unregister_jit_module(const void* code_begin) {
+	std::lock_guard<std::mutex> lock(core_mutex);
+	core_init();
+	auto range = jit_ranges->find((uint64_t) code_begin);
+	if (range == jit_ranges->end())
+		return;
+	// Headers in the range go away with the code
+	auto it = registered_headers->begin();
+	while (it != registered_headers->end()) {
+		if ((*it)->function_addr >= range->first && (*it)->function_addr < range->second) {
+			retire_line_counts(*it);
+			it = registered_headers->erase(it);
+		} else
+			++it;
+	}
+	jit_ranges->erase(range);
+	pending_jit_registrations->erase(std::remove_if(pending_jit_registrations->begin(), pending_jit_registrations->end(), 
+		[&](const struct d2x_jit_registration &r) { return r.code_begin == code_begin; }), 
+		pending_jit_registrations->end());
+	if (backend != nullptr)
+		backend.load()->unregister_jit_module(code_begin);
+}
+
+typedef const struct d2x_backend_ops* (*backend_init_t)(const struct d2x_core_ops*);
+
+int load_backend(void) {
+	if (backend != nullptr)
+		return 0;
+	std::lock_guard<std::mutex> lock(core_mutex);
+	core_init();
+	if (backend != nullptr)
+		return 0;
+	const char* path = getenv("D2X_BACKEND_PATH");
+	if (path == nullptr)
+		path = "libd2x_runtime_backend.so";
+	void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (handle == nullptr) {
+		std::cout << "Failed to load D2X backend: " << dlerror() << std::endl;
+		return -1;
+	}
+	backend_init_t init = (backend_init_t) dlsym(handle, "d2x_backend_init");
+	const struct d2x_backend_ops* ops = init ? init(&core_ops) : nullptr;
+	if (ops == nullptr) {
+		std::cout << "Failed to load D2X backend: " << path << " is not a compatible backend" << std::endl;
+		dlclose(handle);
+		return -1;
+	}
+	// Replay everything registered so far. JIT ranges go first so their headers are adopted
+	for (auto &r: *pending_jit_registrations) {
+		if (r.elf_image.size()) 
+			ops->register_jit_module(r.name.c_str(), r.load_base, r.code_begin, r.code_end, 
+				r.elf_image.data(), r.elf_image.size(), r.headers.data(), r.headers.size());
+		else {
+			std::vector<const char*> files;
+			for (auto &f: r.files)
+				files.push_back(f.c_str());
+			ops->register_jit_line_table(r.name.c_str(), r.load_base, r.code_begin, r.code_end, 
+				r.lines.data(), r.lines.size(), files.data(), files.size(), r.headers.data(), r.headers.size());
+		}
+	}
+	pending_jit_registrations->clear();
+	for (auto h: *registered_headers)
+		ops->register_header(h);
+	backend = ops;
+	return 0;
+}
+
+void d2x_hook(unsigned long long function_addr, int line) {
+	// Hooks are only enabled by the backend. The CFA of this frame is the stack pointer of the 
+	// generated code, so the backend can find its frame whatever the core adds in between
+	if (backend != nullptr)
+		backend.load()->hook(function_addr, line, (unsigned long long) __builtin_dwarf_cfa());
+}
+
+// Resolvers only run while the backend renders a value
+namespace rtv {
+	void* find_stack_var(std::string varname) {
+		return backend.load()->find_stack_var(varname);
+	}
+	void sink_write(std::string value) {
+		backend.load()->sink_write(value);
+	}
+	int sink_full(void) {
+		return backend.load()->sink_full();
+	}
+	int budget_exhausted(void) {
+		return backend.load()->budget_exhausted();
+	}
+}
+
+// Returned to gdb instead of a command sequence when the backend is missing
+static const char* backend_missing_command = "echo D2X backend is not available\\n";
+
+/* API functions to be invoked from the debugger */
+namespace cmd {
+void xbt(void* ip, void* sp, void* bp, void* bx) {
+	if (load_backend() == 0)
+		backend.load()->xbt(ip, sp, bp, bx);
+}
+void xlist(void* ip, void* sp, void* bp, void* bx) {	
+	if (load_backend() == 0)
+		backend.load()->xlist(ip, sp, bp, bx);
+}
+void xframe(void* ip, void* sp, void* bp, void* bx, const char* update) {
+	if (load_backend() == 0)
+		backend.load()->xframe(ip, sp, bp, bx, update);
+}
+void xvars(void* ip, void* sp, void* bp, void* bx, const char* varname) {
+	if (load_backend() == 0)
+		backend.load()->xvars(ip, sp, bp, bx, varname);
+}
+void xfvl(void* ip, void* sp, void* bp, void* bx, const char* varname) {
+	if (load_backend() == 0)
+		backend.load()->xfvl(ip, sp, bp, bx, varname);
+}
+void xvalue(void* ip, void* sp, void* bp, void* bx, const char* varname, unsigned long long offset, unsigned long long len) {
+	if (load_backend() == 0)
+		backend.load()->xvalue(ip, sp, bp, bx, varname, offset, len);
+}
+long long xvalue_chunk(void* ip, void* sp, void* bp, void* bx, const char* varname, char* buffer, 
+		unsigned long long offset, unsigned long long len) {
+	if (load_backend())
+		return -1;
+	return backend.load()->xvalue_chunk(ip, sp, bp, bx, varname, buffer, offset, len);
+}
+const char* xbt_records(void* ip, void* sp, void* bp, void* bx) {
+	if (load_backend())
+		return nullptr;
+	return backend.load()->xbt_records(ip, sp, bp, bx);
+}
+const char* xvars_records(void* ip, void* sp, void* bp, void* bx) {
+	if (load_backend())
+		return nullptr;
+	return backend.load()->xvars_records(ip, sp, bp, bx);
+}
+const char* xbreak_records(void) {
+	if (load_backend())
+		return nullptr;
+	return backend.load()->xbreak_records();
+}
+// Line counts only need the tables
+void xcounts(const char* filename) {
+	write_line_counts(filename);
+}
+void xhistory(const char* varname, int count) {
+	std::cout << get_history(varname, count);
+}
+void xbudget(long long time_ms, long long output_bytes) {
+	if (load_backend() == 0)
+		backend.load()->xbudget(time_ms, output_bytes);
+}
+const char* xbreak(void* ip, void* sp, void* bp, void* bx, const char* source_spec) {
+	if (load_backend())
+		return backend_missing_command;
+	return backend.load()->xbreak(ip, sp, bp, bx, source_spec);
+}
+void xbreak_bind(int break_id, int first_bp, int last_bp) {
+	if (load_backend() == 0)
+		backend.load()->xbreak_bind(break_id, first_bp, last_bp);
+}
+const char* xcbreak(void* ip, void* sp, void* bp, void* bx, const char* source_spec, const char* condition) {
+	if (load_backend())
+		return backend_missing_command;
+	return backend.load()->xcbreak(ip, sp, bp, bx, source_spec, condition);
+}
+const char* xwatch(void* ip, void* sp, void* bp, void* bx, const char* varname) {
+	if (load_backend())
+		return backend_missing_command;
+	return backend.load()->xwatch(ip, sp, bp, bx, varname);
+}
+const char* xstep(void* ip, void* sp, void* bp, void* bx, const char* mode) {
+	if (load_backend())
+		return backend_missing_command;
+	return backend.load()->xstep(ip, sp, bp, bx, mode);
+}
+const char* xdel(void* ip, void* sp, void* bp, void* bx, const char* source_spec) {
+	if (load_backend())
+		return backend_missing_command;
+	return backend.load()->xdel(ip, sp, bp, bx, source_spec);
+}
+}
+}
+}
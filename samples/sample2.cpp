@@ -11,7 +11,7 @@ static builder::dyn_var<void*(void*)> to_int_p(builder::as_global("(int*)"));
 int main(int argc, char* argv[]) {
 
 	std::cout << "#include <stdio.h>\n";
-	std::cout << "#include \"d2x_runtime/d2x_runtime.h\"\n";
+	std::cout << "#include \"d2x_runtime/d2x_runtime_core.h\"\n";
 
 	d2x::d2x_context context;
 	
@@ -0,0 +1,67 @@
+#include "d2x/d2x.h"
+#include <iostream>
+
+#define STR1(x)  #x
+#define STR(x)  STR1(x)
+#define BASE_DIR STR(BASE_DIR_X)
+
+// Generates a loop with hook points, line counters and the history of sum. Every generated 
+// line starts with line_instrumentation(), which is empty unless the line starts a new DSL statement
+int main(int argc, char* argv[]) {
+
+	std::cout << "#include <stdio.h>\n";
+	std::cout << "#include \"d2x_runtime/d2x_runtime_core.h\"\n";
+
+	d2x::d2x_context context;
+	context.enable_hook_points();
+	context.enable_line_counters();
+	context.enable_history();
+	
+	std::cout << context.begin_section();
+	context.track_var("sum", "sum");
+	
+	context.push_source_loc({BASE_DIR "/samples/sample3.txt", 1, "main", 0});
+	std::cout << "int main(int argc, char* argv[]) {" << std::endl;
+	context.nextl();
+
+	// Instrumentation comes before the declaration, so sum only becomes live after it
+	context.push_source_loc({BASE_DIR "/samples/sample3.txt", 2, "main", 1});
+	std::cout << "\t" << context.line_instrumentation() << "int sum = 0;" << std::endl;
+	context.create_var("sum");
+	context.update_var("sum", "sum");
+	context.set_var_here("sum", "sum");
+	context.nextl();
+
+	context.push_source_loc({BASE_DIR "/samples/sample3.txt", 3, "main", 2});
+	std::cout << "\t" << context.line_instrumentation() << "for (int i = 0; i < 10; i++) {" << std::endl;
+	context.nextl();
+
+	context.push_var_scope();
+	context.create_var("i");
+	context.update_var("i", "i");
+	context.push_source_loc({BASE_DIR "/samples/sample3.txt", 4, "main", 3});
+	context.insert_live_vars();
+	std::cout << "\t\t" << context.line_instrumentation() << "sum = sum + i;" << std::endl;
+	context.pop_var_scope();
+	context.nextl();
+
+	context.push_source_loc({BASE_DIR "/samples/sample3.txt", 3, "main", 2});
+	std::cout << "\t}" << std::endl;
+	context.nextl();
+
+	context.push_source_loc({BASE_DIR "/samples/sample3.txt", 5, "main", 4});
+	std::cout << "\t" << context.line_instrumentation() << "printf(\"%d\\n\", sum);" << std::endl;
+	context.nextl();
+
+	context.push_source_loc({BASE_DIR "/samples/sample3.txt", 6, "main", 5});
+	std::cout << "\t" << context.line_instrumentation() << "return 0;" << std::endl;
+	context.nextl();
+
+	context.push_source_loc({BASE_DIR "/samples/sample3.txt", 6, "main", 5});
+	std::cout << "}" << std::endl;
+
+	context.emit_function_info(std::cout);
+	context.end_section();
+
+	return 0;
+}
@@ -5,120 +5,294 @@ namespace d2x {
 namespace rt {
 const char string_t_name[] = "std::string";
 builder::dyn_var<void* (string)> find_stack_var(builder::as_global("d2x::runtime::rtv::find_stack_var"));
+builder::dyn_var<void (string)> sink_write(builder::as_global("d2x::runtime::rtv::sink_write"));
+builder::dyn_var<int (void)> sink_full(builder::as_global("d2x::runtime::rtv::sink_full"));
+builder::dyn_var<int (void)> budget_exhausted(builder::as_global("d2x::runtime::rtv::budget_exhausted"));
 }
 int runtime_value_resolver::resolver_counter = 0;
 
 void d2x_context::reset_context(void) {
-	source_loc_table.clear();
-	var_table.clear();
+	source_frames.clear();
+	source_line_begin.clear();
+	line_vars.clear();
+	var_line_begin.clear();
 	live_vars.clear();
-	live_vars.resize(1);			
+	scope_begin.clear();
+	scope_begin.push_back(0);
 	current_line_number = 0;
-	var_table.resize(current_line_number + 1);
+	resize_lines(current_line_number + 1);
 }
 
 d2x_context::d2x_context() {
+	intern("");
 	reset_context();
 }
+
+name_id d2x_context::intern(const std::string &s) {
+	auto it = name_index.find(s);
+	if (it != name_index.end())
+		return it->second;
+	name_id id = names.size();
+	names.push_back(s);
+	name_index[s] = id;
+	return id;
+}
+
+const std::string& d2x_context::name_of(name_id id) const {
+	return names[id];
+}
+
+// Same as resizing a vector of lines, dropped lines give up their entries
+void d2x_context::resize_lines(int n) {
+	if (n < (int)source_line_begin.size()) {
+		source_frames.resize(source_line_begin[n]);
+		source_line_begin.resize(n);
+		line_vars.resize(var_line_begin[n]);
+		var_line_begin.resize(n);
+		return;
+	}
+	source_line_begin.resize(n, source_frames.size());
+	var_line_begin.resize(n, line_vars.size());
+}
+
+int d2x_context::source_line_end(int line) {
+	return line + 1 < (int)source_line_begin.size() ? source_line_begin[line + 1] : source_frames.size();
+}
+
+int d2x_context::var_line_end(int line) {
+	return line + 1 < (int)var_line_begin.size() ? var_line_begin[line + 1] : line_vars.size();
+}
+
+var_slot* d2x_context::find_var_here(name_id id) {
+	if (id >= (int)var_here_index.size() || var_line_begin.empty())
+		return nullptr;
+	int pos = var_here_index[id];
+	if (pos < var_line_begin.back() || pos >= (int)line_vars.size() || line_vars[pos].name != id)
+		return nullptr;
+	return &line_vars[pos];
+}
+
+void d2x_context::add_var_here(const var_slot &slot) {
+	if (slot.name >= (int)var_here_index.size())
+		var_here_index.resize(names.size(), -1);
+	var_here_index[slot.name] = line_vars.size();
+	line_vars.push_back(slot);
+}
+
+// Innermost scope first
+var_slot* d2x_context::find_live_var(name_id id) {
+	for (int i = (int)live_vars.size() - 1; i >= 0; i--) {
+		if (live_vars[i].name == id)
+			return &live_vars[i];
+	}
+	return nullptr;
+}
+
 std::string d2x_context::begin_section(void) {
 	reset_context();
 	current_anchor_name = "d2x_section_anchor_" + std::to_string(anchor_counter);
 	current_anchor_counter = anchor_counter;
 	anchor_counter++;
+	// Instrumentation refers to string ids while lines are generated
+	for (auto id: string_table)
+		section_string_ids[id] = -1;
+	string_table.clear();
 
 	nextl();
-	return "static void " + current_anchor_name + "(void) {}\n";
+	// The line of the anchor is recorded with __LINE__ on the same line so the runtime 
+	// can match headers without looking up the anchor in the debug info
+	std::string anchor = "static void " + current_anchor_name + "(void) {} static const int d2x_" 
+		+ std::to_string(current_anchor_counter) + "_anchor_line = __LINE__;";
+	// The counter array is only sized in emit_function_info, declare it here so 
+	// instrumented lines can refer to it. Everything stays on the anchor line
+	section_has_counters = emit_line_counters;
+	if (section_has_counters)
+		anchor += " namespace { extern struct d2x::runtime::d2x_line_counter d2x_" 
+			+ std::to_string(current_anchor_counter) + "_counters[]; }";
+	return anchor + "\n";
 }
 
 void d2x_context::end_section(void) {
 	current_anchor_name = "";
+	section_has_counters = false;
+	history_vars.clear();
 	current_line_number = -1;	
 }
 
 void d2x_context::nextl(void) {
 	current_line_number++;
-	var_table.resize(current_line_number + 1);
-	source_loc_table.resize(current_line_number + 1);
+	resize_lines(current_line_number + 1);
 	insert_live_vars();
 }
 
-void d2x_context::push_source_loc(source_loc loc) {
+void d2x_context::push_source_loc(const source_loc &loc) {
+	push_source_loc(intern(loc.file), loc.line, intern(loc.fname), loc.foffset);
+}
+
+void d2x_context::push_source_loc(name_id file, int line, name_id fname, int foffset) {
 	// We are currently not insider any function
 	if (current_line_number == -1) 
 		return;
-	var_table.resize(current_line_number + 1);
-	source_loc_table.resize(current_line_number + 1);
-	source_loc_table[current_line_number].push_back(loc);		
+	resize_lines(current_line_number + 1);
+	source_frame frame = {file, line, fname, foffset};
+	source_frames.push_back(frame);		
+}
+
+void d2x_context::enable_hook_points(bool enable) {
+	emit_hook_points = enable;
+}
+
+void d2x_context::enable_line_counters(bool enable) {
+	emit_line_counters = enable;
+}
+
+void d2x_context::enable_history(bool enable) {
+	emit_history = enable;
+}
+
+void d2x_context::track_var(const std::string &vname, const std::string &expr) {
+	track_var(intern(vname), expr);
+}
+
+void d2x_context::track_var(name_id vname, const std::string &expr) {
+	history_vars[vname] = expr;
+}
+
+// A generated line starts a new DSL location if the top of its extended stack
+// differs from that of the previous line
+bool d2x_context::starts_new_location(void) {
+	if (current_line_number <= 0 || current_line_number >= (int)source_line_begin.size())
+		return false;
+	int begin = source_line_begin[current_line_number];
+	if (source_line_end(current_line_number) == begin)
+		return false;
+	int prev_begin = source_line_begin[current_line_number - 1];
+	if (begin == prev_begin)
+		return true;
+	return source_frames[begin].line != source_frames[prev_begin].line 
+		|| source_frames[begin].file != source_frames[prev_begin].file;
+}
+
+std::string d2x_context::line_instrumentation(void) {
+	if (current_line_number == -1 || !starts_new_location())
+		return "";
+	std::string code;
+	if (section_has_counters) {
+		code += "d2x::runtime::d2x_count_line(d2x_" + std::to_string(current_anchor_counter) + "_counters[" 
+			+ std::to_string(current_line_number) + "]); ";
+	}
+	if (emit_hook_points) {
+		code += "if (__builtin_expect(d2x::runtime::d2x_hooks_enabled, 0)) d2x::runtime::d2x_hook((unsigned long long)" 
+			+ current_anchor_name + ", " + std::to_string(current_line_number) + "); ";
+	}
+	if (emit_history) {
+		for (auto &v: history_vars) {
+			if (find_var_here(v.first) == nullptr)
+				continue;
+			code += "d2x::runtime::d2x_record_history((unsigned long long)" + current_anchor_name + ", " 
+				+ std::to_string(current_line_number) + ", " + std::to_string(get_string_id(v.first)) 
+				+ ", (" + v.second + ")); ";
+		}
+	}
+	return code;
 }
 
 void d2x_context::push_var_scope(void) {
-	live_vars.push_back(std::map<std::string, value_pair>());	
+	scope_begin.push_back(live_vars.size());
 }
 void d2x_context::pop_var_scope(void) {
-	live_vars.pop_back();
+	live_vars.resize(scope_begin.back());
+	scope_begin.pop_back();
+}
+
+void d2x_context::create_var(const std::string &vname) {
+	create_var(intern(vname));
 }
 
-void d2x_context::create_var(std::string vname) {
+void d2x_context::create_var(name_id vname) {
 	value_pair v;
-	v.value = "";
+	v.value = 0;
 	v.rvalue = nullptr;
-	live_vars.back()[vname] = v;
+	for (int i = scope_begin.back(); i < (int)live_vars.size(); i++) {
+		if (live_vars[i].name == vname) {
+			live_vars[i].value = v;
+			return;
+		}
+	}
+	var_slot slot = {vname, v};
+	live_vars.push_back(slot);
 }
 
-void d2x_context::delete_var(std::string vname) {
-	live_vars.back().erase(vname);
+void d2x_context::delete_var(const std::string &vname) {
+	delete_var(intern(vname));
 }
 
-void d2x_context::insert_live_vars(void) {
-	auto &current = var_table.back();
-	// Update values walking scopes backwards
-	for (int i = (int)live_vars.size() - 1; i >= 0; i--) {
-		auto &scope = live_vars[i];
-		for (auto var = scope.begin(); var != scope.end(); var++) {
-			if (current.find(var->first) == current.end()) {
-				var_table.back()[var->first] = var->second;
-			}
+void d2x_context::delete_var(name_id vname) {
+	for (int i = scope_begin.back(); i < (int)live_vars.size(); i++) {
+		if (live_vars[i].name == vname) {
+			live_vars.erase(live_vars.begin() + i);
+			return;
 		}
 	}
 }
 
-void d2x_context::update_var(std::string vname, std::string value) {
+void d2x_context::insert_live_vars(void) {
 	// Update values walking scopes backwards
 	for (int i = (int)live_vars.size() - 1; i >= 0; i--) {
-		if (live_vars[i].find(vname) != live_vars[i].end()) {
-			value_pair v;
-			v.value = value;
-			v.rvalue = nullptr;
-			live_vars[i][vname] = v;
-			break;
-		}
+		name_id id = live_vars[i].name;
+		if (find_var_here(id) == nullptr)
+			add_var_here(live_vars[i]);
 	}
 }
-void d2x_context::update_var(std::string vname, runtime_value_resolver& r) {
-	// Update values walking scopes backwards
-	for (int i = (int)live_vars.size() - 1; i >= 0; i--) {
-		if (live_vars[i].find(vname) != live_vars[i].end()) {
-			value_pair v;
-			v.value = "";
-			v.rvalue = &r;
-			live_vars[i][vname] = v;
-			break;
-		}
-	}
+
+void d2x_context::update_var(const std::string &vname, const std::string &value) {
+	update_var(intern(vname), intern(value));
 }
 
-void d2x_context::set_var_here(std::string vname, std::string value) {
+void d2x_context::update_var(const std::string &vname, runtime_value_resolver& r) {
+	update_var(intern(vname), r);
+}
+
+void d2x_context::update_var(name_id vname, name_id value) {
+	var_slot* slot = find_live_var(vname);
+	if (slot == nullptr)
+		return;
+	slot->value.value = value;
+	slot->value.rvalue = nullptr;
+}
+
+void d2x_context::update_var(name_id vname, runtime_value_resolver& r) {
+	var_slot* slot = find_live_var(vname);
+	if (slot == nullptr)
+		return;
+	slot->value.value = 0;
+	slot->value.rvalue = &r;
+}
+
+void d2x_context::set_var_here(const std::string &vname, const std::string &value) {
+	set_var_here(intern(vname), intern(value));
+}
+
+void d2x_context::set_var_here(const std::string &vname, runtime_value_resolver& resolver) {
+	set_var_here(intern(vname), resolver);
+}
+
+void d2x_context::set_var_here(name_id vname, name_id value) {
 	value_pair v;
 	v.value = value;
 	v.rvalue = nullptr;
-	var_table.back()[vname] = v;
+	var_slot* slot = find_var_here(vname);
+	if (slot != nullptr) {
+		slot->value = v;
+		return;
+	}
+	var_slot s = {vname, v};
+	add_var_here(s);
 }
 
-void d2x_context::set_var_here(std::string vname, runtime_value_resolver& resolver) {
-	value_pair v;
-	v.value = "";
-	v.rvalue = &resolver;
-	var_table.back()[vname] = v;
+void d2x_context::set_var_here(name_id vname, runtime_value_resolver& resolver) {
+	set_var_here(vname, 0);
+	find_var_here(vname)->value.rvalue = &resolver;
 }
 
 
@@ -1,5 +1,7 @@
 #include "d2x/d2x.h"
 #include <utility>
+#include <sstream>
+#include <algorithm>
 #include "blocks/c_code_generator.h"
 namespace d2x {
 
@@ -42,8 +44,12 @@ struct d2x_var_entry {
 3. The third object is a string list which is just an array of char*. All string variables are just offsets into 
 this table. 
 
+Objects 1.a to 3 are only emitted if no earlier section in the same output had a table with identical contents,
+otherwise the header points to the earlier array.
+
 4. After this we have a function_header which just has back pointers and sizes for above arrays. This also has information
-about the function itself.
+about the function itself. All headers are placed in the D2X_entry section so tools can find them in 
+the binary without running it.
 
 struct d2x_function_header {
 	void (*)(void) function_addr; // start address of the function for matching
@@ -63,62 +69,96 @@ struct d2x_function_header {
 	int string_table_len;
 	char** string_table; // points to 3
 
+	int flags; // D2X_HEADER_* bits describing what was emitted in the section
+
+	struct d2x_line_counter* counters; // points to 6 if line counters are enabled, NULL otherwise
+
 	
-	// scratch space for use at runtime
+	// generated file and line of the section anchor, from __FILE__ and __LINE__ on the anchor line
 	const char* identified_filename;
 	int identified_line;
 }
 
 5. Finally there is a constructor call to d2x_register_header
+
+6. If line counters are enabled, an array of d2x_line_counter of size number of lines in the function. 
+It is declared along with the anchor in begin_section and defined after the tables. Only lines that start
+a new DSL location are incremented.
 */
 
 
-int d2x_context::get_string_id(std::string s) {
-	if (reverse_string_table.find(s) != reverse_string_table.end()) {
-		return reverse_string_table[s];
-	}
+int d2x_context::get_string_id(name_id id) {
+	if (id >= (int)section_string_ids.size())
+		section_string_ids.resize(names.size(), -1);
+	if (section_string_ids[id] != -1)
+		return section_string_ids[id];
 	int idx = string_table.size();
-	string_table.push_back(s);
-	reverse_string_table[s] = idx;
+	string_table.push_back(id);
+	section_string_ids[id] = idx;
 	return idx;
 }
 
 
+void d2x_context::begin_translation_unit(void) {
+	emitted_tables.clear();
+	unit_resolvers.clear();
+}
+
+// Tables are only read by the runtime, so sections with the same contents for a table share 
+// the array emitted by the first of them in the translation unit. Returns the name of the 
+// array to point to
+std::string d2x_context::emit_table(std::ostream &oss, const std::string &type, const std::string &suffix, 
+		const std::string &body) {
+	std::string key = type + "\n" + body;
+	auto it = emitted_tables.find(key);
+	if (it != emitted_tables.end())
+		return it->second;
+	std::string name = "d2x_" + std::to_string(current_anchor_counter) + suffix;
+	oss << type << " " << name << "[] = {\n" << body << "};\n";
+	emitted_tables[key] = name;
+	return name;
+}
+
 void d2x_context::emit_function_info(std::ostream &oss) {
 	oss << "/*  Begin debug information for section: " << current_anchor_counter << " */\n";		
-	string_table.clear();
-	reverse_string_table.clear();
 	emit_source_list.clear();	
 	emit_source_table.clear();
 	emit_var_table.clear();
 	emit_var_list.clear();
 	used_resolvers.clear();
 	
-	for (int lno = 0; lno < (int)source_loc_table.size(); lno++) {
-		auto &frames = source_loc_table[lno];
-		emit_source_table.push_back(std::make_pair(frames.size(), emit_source_list.size()));
-		for (auto frame: frames) {
-			std::string name = frame.file;
-			int line = frame.line;
-			int name_id = get_string_id(name);
+	for (int lno = 0; lno < (int)source_line_begin.size(); lno++) {
+		int begin = source_line_begin[lno], end = source_line_end(lno);
+		emit_source_table.push_back(std::make_pair(end - begin, emit_source_list.size()));
+		for (int f = begin; f < end; f++) {
+			auto &frame = source_frames[f];
+			int file_id = get_string_id(frame.file);
 			int fname_id = get_string_id(frame.fname);
-			int fline = frame.foffset;
-			emit_source_list.push_back(std::make_tuple(name_id, line, fname_id, fline));	
+			emit_source_list.push_back(std::make_tuple(file_id, frame.line, fname_id, frame.foffset));	
 		}		
 	}
 
-	for (int lno = 0; lno < (int) var_table.size(); lno++) {
-		auto &vars = var_table[lno];
-		emit_var_table.push_back(std::make_pair(vars.size(), emit_var_list.size()));
-		for (auto const& var: vars) {
-			int varname = get_string_id(var.first);
-			int varvalue = get_string_id(var.second.value);
-			runtime_value_resolver* rvarvalue = var.second.rvalue;
+	std::vector<const var_slot*> vars;
+	for (int lno = 0; lno < (int)var_line_begin.size(); lno++) {
+		int begin = var_line_begin[lno], end = var_line_end(lno);
+		emit_var_table.push_back(std::make_pair(end - begin, emit_var_list.size()));
+		// Vars of a line are listed by name, independent of the order they became live in
+		vars.clear();
+		for (int i = begin; i < end; i++)
+			vars.push_back(&line_vars[i]);
+		std::sort(vars.begin(), vars.end(), [&](const var_slot* a, const var_slot* b) {
+			return name_of(a->name) < name_of(b->name);
+		});
+		for (auto v: vars) {
+			auto const& var = *v;
+			int varname = get_string_id(var.name);
+			int varvalue = get_string_id(var.value.value);
+			runtime_value_resolver* rvarvalue = var.value.rvalue;
 			if (rvarvalue != nullptr) {
 				if (std::find(used_resolvers.begin(), used_resolvers.end(), rvarvalue) 
 					== used_resolvers.end()) {
-					if (std::find(emitted_resolvers.begin(), emitted_resolvers.end(), rvarvalue) 
-						== emitted_resolvers.end()) {	
+					if (std::find(unit_resolvers.begin(), unit_resolvers.end(), rvarvalue) 
+						== unit_resolvers.end()) {	
 						used_resolvers.push_back(rvarvalue);
 					}
 				}
@@ -129,6 +169,12 @@ void d2x_context::emit_function_info(std::ostream &oss) {
 
 	// Before we emit any datastructures, we should emit the resolvers
 	for (auto r: used_resolvers) {
+		unit_resolvers.push_back(r);
+		// Defined in an earlier translation unit, only declare it in this one
+		if (std::find(emitted_resolvers.begin(), emitted_resolvers.end(), r) != emitted_resolvers.end()) {
+			oss << "std::string " << r->resolver_name << "(std::string);" << std::endl;
+			continue;
+		}
 		r->gen_resolver();
 		block::c_code_generator generator(oss);
 		generator.curr_indent = 0;
@@ -140,68 +186,80 @@ void d2x_context::emit_function_info(std::ostream &oss) {
 
 
 	// Emit 1.a
-	oss << "static struct d2x::runtime::d2x_source_stack d2x_" << current_anchor_counter << "_source_table[] = {\n";
+	std::stringstream body;
 	int index = 0;
 	for (auto v: emit_source_table) {
-		oss << ident_char << "{" << v.first << ", " << v.second << "}, //" << index << "\n";
+		body << ident_char << "{" << v.first << ", " << v.second << "}, //" << index << "\n";
 		index++;
 	}
-	oss << "};\n";
+	std::string source_table = emit_table(oss, "static struct d2x::runtime::d2x_source_stack", "_source_table", body.str());
 
 	// Emit 1.b
+	body.str("");
 	index = 0;
-	oss << "static struct d2x::runtime::d2x_source_loc d2x_" << current_anchor_counter << "_source_list[] = {\n";
 	for (auto v: emit_source_list) {
-		oss << ident_char << "{" << std::get<0>(v) << ", " << std::get<1>(v) << ", " << std::get<2>(v) << ", " << std::get<3>(v) << "}, //" << index << "\n";
+		body << ident_char << "{" << std::get<0>(v) << ", " << std::get<1>(v) << ", " << std::get<2>(v) << ", " << std::get<3>(v) << "}, //" << index << "\n";
 		index++;
 	}
-	oss << "};\n";
+	std::string source_list = emit_table(oss, "static struct d2x::runtime::d2x_source_loc", "_source_list", body.str());
 
 	// Emit 2.a
-	oss << "static struct d2x::runtime::d2x_var_stack d2x_" << current_anchor_counter << "_var_table[] = {\n";
+	body.str("");
 	for (auto v: emit_var_table) {
-		oss << ident_char << "{" << v.first << ", " << v.second << "},\n";
+		body << ident_char << "{" << v.first << ", " << v.second << "},\n";
 	}
-	oss << "};\n";
+	std::string var_table = emit_table(oss, "static struct d2x::runtime::d2x_var_stack", "_var_table", body.str());
 
 	// Emit 2.b
-	oss << "static struct d2x::runtime::d2x_var_entry d2x_" << current_anchor_counter << "_var_list[] = {\n";
+	body.str("");
 	for (auto v: emit_var_list) {
 		if (v.second.second == nullptr)
-			oss << ident_char << "{" << v.first << ", " << v.second.first << ", 0},\n";
+			body << ident_char << "{" << v.first << ", " << v.second.first << ", 0},\n";
 		else 
-			oss << ident_char << "{" << v.first << ", -1, (unsigned long long)" << v.second.second->resolver_name << "},\n";
+			body << ident_char << "{" << v.first << ", -1, (unsigned long long)" << v.second.second->resolver_name << "},\n";
 	}
-	oss << "};\n";
+	std::string var_list = emit_table(oss, "static struct d2x::runtime::d2x_var_entry", "_var_list", body.str());
 	
 	// Emit 3
-	oss << "static const char* d2x_" << current_anchor_counter << "_string_table[] = {\n";
+	body.str("");
 	for (auto v: string_table) {
-		oss << ident_char << "\"" << v << "\",\n";
+		body << ident_char << "\"" << names[v] << "\",\n";
+	}
+	std::string string_table_name = emit_table(oss, "static const char*", "_string_table", body.str());
+
+	// Emit 6
+	if (section_has_counters) {
+		oss << "namespace { struct d2x::runtime::d2x_line_counter d2x_" << current_anchor_counter << "_counters[" 
+			<< (int)emit_source_table.size() << "]; }\n";
 	}
-	oss << "};\n";
 
 	// Emit 4		
-	oss << "static struct d2x::runtime::d2x_function_header d2x_" << current_anchor_counter << "_function_header = {\n";
+	oss << "static struct d2x::runtime::d2x_function_header d2x_" << current_anchor_counter << "_function_header"
+		" __attribute__((section(\"" << debug_entry_section << "\"), used)) = {\n";
 	// TODO: Change this to take/compute a separate function address expression
 	// For now we assume all functions are C style functions and the address expression is simply the name
 	oss << ident_char << "(unsigned long long)" << current_anchor_name << ", \n";
 	oss << ident_char << (int)emit_source_table.size() << ", \n";
-	oss << ident_char << "d2x_" << current_anchor_counter << "_source_table" << ", \n";
+	oss << ident_char << source_table << ", \n";
 	oss << ident_char << (int)emit_source_list.size() << ", \n";
-	oss << ident_char << "d2x_" << current_anchor_counter << "_source_list" << ", \n";
+	oss << ident_char << source_list << ", \n";
 
 	oss << ident_char << (int)emit_var_table.size() << ", \n";
-	oss << ident_char << "d2x_" << current_anchor_counter << "_var_table" << ", \n";
+	oss << ident_char << var_table << ", \n";
 	oss << ident_char << (int)emit_var_list.size() << ", \n";
-	oss << ident_char << "d2x_" << current_anchor_counter << "_var_list" << ", \n";
+	oss << ident_char << var_list << ", \n";
 
 	oss << ident_char << (int)string_table.size() << ", \n";
-	oss << ident_char << "d2x_" << current_anchor_counter << "_string_table" << ", \n";
+	oss << ident_char << string_table_name << ", \n";
+
+	oss << ident_char << (emit_hook_points ? "D2X_HEADER_HOOKS" : "0") << ", \n";
+	if (section_has_counters)
+		oss << ident_char << "d2x_" << current_anchor_counter << "_counters" << ", \n";
+	else
+		oss << ident_char << "NULL, \n";
 
-	// Scratch values initialized to NULL and -1 
-	oss << ident_char << "NULL, \n";
-	oss << ident_char << "-1, \n";
+	oss << ident_char << "__FILE__, \n";
+	oss << ident_char << "d2x_" << current_anchor_counter << "_anchor_line, \n";
 
 	oss << "};\n";
 
@@ -9,11 +9,23 @@
 #include <dlfcn.h>
 #include <link.h>
 #include <iostream>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <cstring>
+#include <elf.h>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 namespace d2x {
 namespace util {
 
 static std::map<std::string, Dwarf_Debug> debug_map;
+static std::map<std::string, int> debug_fd_map;
+
+static void load_debug_index(const char* filename, Dwarf_Debug dbg);
+static void release_debug_index(Dwarf_Debug dbg);
 
 int find_debug_info(const char* filename, Dwarf_Debug* ret) {
 	std::string path = filename;
@@ -33,10 +45,146 @@ int find_debug_info(const char* filename, Dwarf_Debug* ret) {
 		return -1;
 	}
 	debug_map[path] = to_ret;
+	debug_fd_map[path] = fd;
+	load_debug_index(filename, to_ret);
 	*ret = to_ret;
 	return 0;	
 }
 
+// Drops the cached debug info for filename so it is reloaded on the next lookup
+void release_debug_info(const char* filename) {
+	std::string path = filename;
+	if (debug_map.find(path) == debug_map.end()) 
+		return;
+	Dwarf_Error de;
+	release_debug_index(debug_map[path]);
+	dwarf_finish(debug_map[path], &de);
+	close(debug_fd_map[path]);
+	debug_map.erase(path);
+	debug_fd_map.erase(path);
+}
+
+// libdwarf object access for ELF images that only exist in memory (JIT compiled code). 
+// Only 64 bit images whose debug info is already relocated are supported
+struct memory_elf_object {
+	std::vector<unsigned char> image;
+	const Elf64_Ehdr* ehdr;
+	const Elf64_Shdr* shdrs;
+	const char* shstrtab;
+	size_t shstrtab_size;
+	Dwarf_Obj_Access_Interface interface;
+};
+
+static bool section_in_image(const Elf64_Shdr &shdr, size_t size) {
+	return shdr.sh_offset <= size && shdr.sh_size <= size - shdr.sh_offset;
+}
+
+static int memory_elf_get_section_info(void* obj, Dwarf_Half section_index, Dwarf_Obj_Access_Section* ret, int* error) {
+	struct memory_elf_object* elf = (struct memory_elf_object*) obj;
+	if (section_index >= elf->ehdr->e_shnum)
+		return DW_DLV_NO_ENTRY;
+	const Elf64_Shdr &shdr = elf->shdrs[section_index];
+	ret->addr = shdr.sh_addr;
+	ret->type = shdr.sh_type;
+	ret->size = shdr.sh_size;
+	// The string table ends with a NUL, checked when the image was loaded
+	ret->name = shdr.sh_name < elf->shstrtab_size ? elf->shstrtab + shdr.sh_name : "";
+	ret->link = shdr.sh_link;
+	ret->info = shdr.sh_info;
+	ret->entrysize = shdr.sh_entsize;
+	return DW_DLV_OK;
+}
+
+static Dwarf_Endianness memory_elf_get_byte_order(void* obj) {
+	struct memory_elf_object* elf = (struct memory_elf_object*) obj;
+	return elf->ehdr->e_ident[EI_DATA] == ELFDATA2MSB ? DW_OBJECT_MSB : DW_OBJECT_LSB;
+}
+
+static Dwarf_Small memory_elf_get_length_size(void* obj) {
+	return 4;
+}
+
+static Dwarf_Small memory_elf_get_pointer_size(void* obj) {
+	return 8;
+}
+
+static Dwarf_Unsigned memory_elf_get_section_count(void* obj) {
+	struct memory_elf_object* elf = (struct memory_elf_object*) obj;
+	return elf->ehdr->e_shnum;
+}
+
+static int memory_elf_load_section(void* obj, Dwarf_Half section_index, Dwarf_Small** ret, int* error) {
+	struct memory_elf_object* elf = (struct memory_elf_object*) obj;
+	if (section_index >= elf->ehdr->e_shnum)
+		return DW_DLV_NO_ENTRY;
+	const Elf64_Shdr &shdr = elf->shdrs[section_index];
+	if (shdr.sh_type == SHT_NOBITS || !section_in_image(shdr, elf->image.size()))
+		return DW_DLV_NO_ENTRY;
+	*ret = (Dwarf_Small*) &elf->image[shdr.sh_offset];
+	return DW_DLV_OK;
+}
+
+static int memory_elf_relocate_a_section(void* obj, Dwarf_Half section_index, Dwarf_Debug dbg, int* error) {
+	return DW_DLV_NO_ENTRY;
+}
+
+static const Dwarf_Obj_Access_Methods memory_elf_methods = {
+	memory_elf_get_section_info,
+	memory_elf_get_byte_order,
+	memory_elf_get_length_size,
+	memory_elf_get_pointer_size,
+	memory_elf_get_section_count,
+	memory_elf_load_section,
+	memory_elf_relocate_a_section,
+};
+
+static std::map<Dwarf_Debug, struct memory_elf_object*> memory_debug_map;
+
+int find_debug_info_in_memory(const void* image, size_t size, Dwarf_Debug* ret) {
+	if (size < sizeof(Elf64_Ehdr))
+		return -1;
+	const Elf64_Ehdr* ehdr = (const Elf64_Ehdr*) image;
+	if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELFCLASS64)
+		return -1;
+	if (ehdr->e_shoff > size || ehdr->e_shnum > (size - ehdr->e_shoff) / sizeof(Elf64_Shdr) 
+			|| ehdr->e_shstrndx >= ehdr->e_shnum)
+		return -1;
+	const Elf64_Shdr &shstr = ((const Elf64_Shdr*) ((const char*) image + ehdr->e_shoff))[ehdr->e_shstrndx];
+	if (!section_in_image(shstr, size) || shstr.sh_size == 0 
+			|| ((const char*) image)[shstr.sh_offset + shstr.sh_size - 1] != 0)
+		return -1;
+
+	// Keep a private copy so the caller can free its buffer
+	struct memory_elf_object* elf = new struct memory_elf_object();
+	elf->image.assign((const unsigned char*) image, (const unsigned char*) image + size);
+	elf->ehdr = (const Elf64_Ehdr*) &elf->image[0];
+	elf->shdrs = (const Elf64_Shdr*) &elf->image[ehdr->e_shoff];
+	elf->shstrtab = (const char*) &elf->image[shstr.sh_offset];
+	elf->shstrtab_size = shstr.sh_size;
+	elf->interface.object = elf;
+	elf->interface.methods = &memory_elf_methods;
+
+	Dwarf_Debug to_ret;
+	Dwarf_Error de;
+	if (dwarf_object_init_b(&elf->interface, NULL, NULL, 0, &to_ret, &de) != DW_DLV_OK) {
+		delete elf;
+		return -1;
+	}
+	memory_debug_map[to_ret] = elf;
+	*ret = to_ret;
+	return 0;
+}
+
+void release_debug_info_in_memory(Dwarf_Debug dbg) {
+	auto it = memory_debug_map.find(dbg);
+	if (it == memory_debug_map.end())
+		return;
+	Dwarf_Error de;
+	dwarf_object_finish(dbg, &de);
+	delete it->second;
+	memory_debug_map.erase(it);
+}
+
 static int dbg_step_cu(Dwarf_Debug dbg) {
 	Dwarf_Error de;
 	Dwarf_Unsigned hl;
@@ -175,9 +323,672 @@ static void find_function_info_with_dbg(Dwarf_Debug dbg, Dwarf_Die die, uint64_t
 	}
 }
 
+/* Debug index cache. Walking all CUs and DIEs of a large binary takes seconds, so the CU 
+ranges, line tables and the vars of each subprogram are extracted once and written to 
+a cache file named after the ELF build-id. Later sessions map the file and answer lookups 
+from it, only going to libdwarf for the DIEs of the vars that are actually read. The cache 
+directory is D2X_INDEX_CACHE_DIR, $XDG_CACHE_HOME/d2x or ~/.cache/d2x. Setting 
+D2X_INDEX_CACHE=0 disables the index. Binaries without a build-id are not indexed. 
+
+Lookups follow the same order as the walks over the DIEs so they give the same answers. The
+CU ranges and line table rows, which may overlap, are split into sorted disjoint ranges at
+build time that keep the answer of the first match in walk order, so lookups are binary 
+searches */
+
+#define D2X_INDEX_VERSION 2
+#define D2X_INDEX_MAX_BUILD_ID 64
+
+struct index_file_header {
+	char magic[4]; // "D2XI"
+	uint32_t version;
+	uint32_t build_id_len;
+	unsigned char build_id[D2X_INDEX_MAX_BUILD_ID];
+	uint32_t num_cus;
+	uint32_t num_lines;
+	uint32_t num_subprograms;
+	uint32_t num_vars;
+	uint32_t num_cu_ranges;
+	uint32_t num_line_ranges;
+	uint32_t strings_size;
+	uint64_t cus_offset;
+	uint64_t cu_ranges_offset;
+	uint64_t lines_offset;
+	uint64_t line_ranges_offset;
+	uint64_t subprograms_offset;
+	uint64_t vars_offset;
+	uint64_t strings_offset;
+};
+
+// CUs are indexed by low_pc/high_pc as in find_cu_die. A CU with DW_AT_ranges and no high_pc
+// covers [low_pc, ~0), CUs without a low_pc are left out
+struct index_cu {
+	uint64_t low;
+	uint64_t high;
+	uint32_t first_line;
+	uint32_t num_lines;
+	uint32_t first_line_range;
+	uint32_t num_line_ranges;
+	uint32_t first_subprogram;
+	uint32_t num_subprograms;
+};
+
+// Disjoint address range, sorted by low. value is a CU or a line table row
+struct index_range {
+	uint64_t low;
+	uint64_t high;
+	uint32_t value;
+	uint32_t padding;
+};
+
+// Line table rows in the order of dwarf_srclines. Strings are offsets in the string pool
+struct index_line {
+	uint64_t addr;
+	uint32_t line;
+	uint32_t file;
+};
+
+// Subprograms with a low_pc in DFS order
+struct index_subprogram {
+	uint64_t low;
+	uint64_t high;
+	uint32_t name;
+	uint32_t linkage;
+	uint32_t first_var;
+	uint32_t num_vars;
+};
+
+// Direct children first and then the vars of the first lexical block
+struct index_var {
+	uint64_t die_offset;
+	uint32_t name;
+	uint32_t padding;
+};
+
+struct debug_index {
+	const char* data;
+	size_t size;
+	bool mapped;
+	std::vector<char> buffer;
+
+	const struct index_file_header* header;
+	const struct index_cu* cus;
+	const struct index_range* cu_ranges;
+	const struct index_line* lines;
+	const struct index_range* line_ranges;
+	const struct index_subprogram* subprograms;
+	const struct index_var* vars;
+	const char* strings;
+};
+
+static std::map<Dwarf_Debug, struct debug_index*> debug_index_map;
+
+// Index under construction
+struct index_builder {
+	std::vector<struct index_cu> cus;
+	std::vector<struct index_range> cu_ranges;
+	std::vector<struct index_line> lines;
+	std::vector<struct index_range> line_ranges;
+	std::vector<struct index_subprogram> subprograms;
+	std::vector<struct index_var> vars;
+	std::string strings;
+	std::map<std::string, uint32_t> string_offsets;
+
+	uint32_t add_string(const std::string &s) {
+		auto it = string_offsets.find(s);
+		if (it != string_offsets.end())
+			return it->second;
+		uint32_t offset = strings.size();
+		strings.append(s);
+		strings.push_back(0);
+		string_offsets[s] = offset;
+		return offset;
+	}
+};
+
+static bool read_build_id(const char* filename, std::string &build_id) {
+	std::ifstream file(filename, std::ios::binary);
+	Elf64_Ehdr ehdr;
+	if (!file.read((char*) &ehdr, sizeof(ehdr)))
+		return false;
+	if (memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 || ehdr.e_ident[EI_CLASS] != ELFCLASS64)
+		return false;
+	std::vector<Elf64_Shdr> shdrs(ehdr.e_shnum);
+	file.seekg(ehdr.e_shoff);
+	if (!file.read((char*) shdrs.data(), ehdr.e_shnum * sizeof(Elf64_Shdr)))
+		return false;
+	for (auto &sh: shdrs) {
+		if (sh.sh_type != SHT_NOTE)
+			continue;
+		std::vector<char> notes(sh.sh_size);
+		file.seekg(sh.sh_offset);
+		if (!file.read(notes.data(), sh.sh_size))
+			return false;
+		size_t pos = 0;
+		while (pos + sizeof(Elf64_Nhdr) <= notes.size()) {
+			const Elf64_Nhdr* note = (const Elf64_Nhdr*) &notes[pos];
+			size_t name_pos = pos + sizeof(Elf64_Nhdr);
+			size_t desc_pos = name_pos + ((note->n_namesz + 3) & ~3);
+			if (desc_pos + note->n_descsz > notes.size())
+				break;
+			if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 && memcmp(&notes[name_pos], "GNU", 4) == 0
+					&& note->n_descsz <= D2X_INDEX_MAX_BUILD_ID) {
+				build_id.assign(&notes[desc_pos], note->n_descsz);
+				return note->n_descsz > 0;
+			}
+			pos = desc_pos + ((note->n_descsz + 3) & ~3);
+		}
+	}
+	return false;
+}
+
+static std::string index_cache_dir(void) {
+	const char* dir = getenv("D2X_INDEX_CACHE_DIR");
+	if (dir != NULL)
+		return dir;
+	dir = getenv("XDG_CACHE_HOME");
+	if (dir != NULL && dir[0] != 0)
+		return std::string(dir) + "/d2x";
+	dir = getenv("HOME");
+	if (dir != NULL)
+		return std::string(dir) + "/.cache/d2x";
+	return "";
+}
+
+static void make_dirs(const std::string &path) {
+	for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+		mkdir(path.substr(0, pos).c_str(), 0755);
+		if (pos == std::string::npos)
+			break;
+	}
+}
+
+static bool die_pc_range(Dwarf_Die die, Dwarf_Unsigned* lopc, Dwarf_Unsigned* hipc) {
+	Dwarf_Error de;
+	Dwarf_Half ret_form;
+	enum Dwarf_Form_Class ret_class;
+	if (dwarf_lowpc(die, lopc, &de) != DW_DLV_OK)
+		return false;
+	if (!(dwarf_highpc_b(die, hipc, &ret_form, &ret_class, &de) == DW_DLV_OK)) 
+		*hipc = ~0ULL;	
+	else if (ret_class == DW_FORM_CLASS_CONSTANT)
+		*hipc += *lopc;
+	return true;
+}
+
+static struct index_range make_range(uint64_t low, uint64_t high, uint32_t value) {
+	struct index_range range;
+	range.low = low;
+	range.high = high;
+	range.value = value;
+	range.padding = 0;
+	return range;
+}
+
+// Splits ranges that may overlap into sorted disjoint ones, each with the value of the first
+// range in input order that covers it. That is the answer of a scan over the input
+static void disjoint_ranges(const std::vector<struct index_range> &ranges, std::vector<struct index_range> &out) {
+	std::vector<uint64_t> bounds;
+	std::vector<std::pair<uint64_t, uint32_t>> starts, ends;
+	for (uint32_t i = 0; i < ranges.size(); i++) {
+		if (ranges[i].low >= ranges[i].high)
+			continue;
+		bounds.push_back(ranges[i].low);
+		bounds.push_back(ranges[i].high);
+		starts.push_back(std::make_pair(ranges[i].low, i));
+		ends.push_back(std::make_pair(ranges[i].high, i));
+	}
+	std::sort(bounds.begin(), bounds.end());
+	bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+	std::sort(starts.begin(), starts.end());
+	std::sort(ends.begin(), ends.end());
+	// Input positions of the ranges covering the current bound
+	std::set<uint32_t> active;
+	size_t s = 0, e = 0;
+	for (size_t b = 0; b + 1 < bounds.size(); b++) {
+		for (; e < ends.size() && ends[e].first == bounds[b]; e++)
+			active.erase(ends[e].second);
+		for (; s < starts.size() && starts[s].first == bounds[b]; s++)
+			active.insert(starts[s].second);
+		if (active.empty())
+			continue;
+		uint32_t value = ranges[*active.begin()].value;
+		if (!out.empty() && out.back().high == bounds[b] && out.back().value == value) {
+			out.back().high = bounds[b + 1];
+			continue;
+		}
+		out.push_back(make_range(bounds[b], bounds[b + 1], value));
+	}
+}
+
+static std::string find_die_name(Dwarf_Debug dbg, Dwarf_Die die, std::string &linkage_name);
+
+static void index_vars(Dwarf_Debug dbg, Dwarf_Die die, struct index_builder &builder) {
+	Dwarf_Die child;
+	Dwarf_Error de;
+	Dwarf_Half tag;
+	Dwarf_Die first_block = NULL;
+	if (dwarf_child(die, &child, &de) == DW_DLV_OK) {
+		while (1) {
+			if (dwarf_tag(child, &tag, &de) == DW_DLV_OK) {
+				if (tag == DW_TAG_variable || tag == DW_TAG_formal_parameter) {
+					std::string linkage;
+					struct index_var var;
+					Dwarf_Off off = 0;
+					dwarf_dieoffset(child, &off, &de);
+					var.die_offset = off;
+					var.name = builder.add_string(find_die_name(dbg, child, linkage));
+					var.padding = 0;
+					builder.vars.push_back(var);
+				} else if (tag == DW_TAG_lexical_block && first_block == NULL) 
+					first_block = child;
+			}
+			Dwarf_Die sibling;
+			if (dwarf_siblingof(dbg, child, &sibling, &de) != DW_DLV_OK)
+				break;
+			child = sibling;
+		}
+	}
+	if (first_block != NULL)
+		index_vars(dbg, first_block, builder);
+}
+
+static void index_subprograms(Dwarf_Debug dbg, Dwarf_Die die, struct index_builder &builder) {
+	Dwarf_Half tag;
+	Dwarf_Error de;
+	Dwarf_Unsigned lopc, hipc;
+	if (dwarf_tag(die, &tag, &de) != DW_DLV_OK)
+		return;
+	if (tag == DW_TAG_subprogram) {
+		if (!die_pc_range(die, &lopc, &hipc))
+			return;
+		std::string linkage;
+		std::string name = find_die_name(dbg, die, linkage);
+		if (name == "") {
+			name = "<unnamed>";
+			linkage = "";
+		}
+		struct index_subprogram sub;
+		sub.low = lopc;
+		sub.high = hipc;
+		sub.name = builder.add_string(name);
+		sub.linkage = builder.add_string(linkage);
+		sub.first_var = builder.vars.size();
+		index_vars(dbg, die, builder);
+		sub.num_vars = builder.vars.size() - sub.first_var;
+		builder.subprograms.push_back(sub);
+		return;
+	}
+	Dwarf_Die child;
+	if (dwarf_child(die, &child, &de) == DW_DLV_OK) {
+		while (1) {
+			index_subprograms(dbg, child, builder);
+			Dwarf_Die sibling;
+			if (dwarf_siblingof(dbg, child, &sibling, &de) != DW_DLV_OK)
+				break;
+			child = sibling;
+		}
+	}
+}
+
+static void index_cu_die(Dwarf_Debug dbg, Dwarf_Die cu_die, struct index_builder &builder) {
+	Dwarf_Error de;
+	struct index_cu cu;
+	Dwarf_Unsigned lopc, hipc;
+	if (!die_pc_range(cu_die, &lopc, &hipc))
+		return;
+	cu.low = lopc;
+	cu.high = hipc;
+	cu.first_line = builder.lines.size();
+	Dwarf_Signed lcount;
+	Dwarf_Line *lbuf;
+	if (dwarf_srclines(cu_die, &lbuf, &lcount, &de) == DW_DLV_OK) {
+		for (Dwarf_Signed i = 0; i < lcount; i++) {
+			Dwarf_Addr lineaddr;
+			Dwarf_Unsigned lineno;
+			char* filename;
+			if (dwarf_lineaddr(lbuf[i], &lineaddr, &de) || dwarf_lineno(lbuf[i], &lineno, &de) 
+					|| dwarf_linesrc(lbuf[i], &filename, &de))
+				break;
+			struct index_line line;
+			line.addr = lineaddr;
+			line.line = lineno;
+			line.file = builder.add_string(filename);
+			builder.lines.push_back(line);
+			dwarf_dealloc(dbg, filename, DW_DLA_STRING);
+		}
+		dwarf_srclines_dealloc(dbg, lbuf, lcount);
+	}
+	cu.num_lines = builder.lines.size() - cu.first_line;
+	// The rows a scan of the line table would pick, an exact match of the row address or an
+	// address between the previous row and this one, which picks the previous row
+	std::vector<struct index_range> rows;
+	for (uint32_t i = cu.first_line; i < builder.lines.size(); i++) {
+		uint64_t addr = builder.lines[i].addr;
+		if (i > cu.first_line && builder.lines[i - 1].addr != ~0ULL && builder.lines[i - 1].addr + 1 < addr)
+			rows.push_back(make_range(builder.lines[i - 1].addr + 1, addr, i - 1));
+		if (addr != ~0ULL)
+			rows.push_back(make_range(addr, addr + 1, i));
+	}
+	cu.first_line_range = builder.line_ranges.size();
+	disjoint_ranges(rows, builder.line_ranges);
+	cu.num_line_ranges = builder.line_ranges.size() - cu.first_line_range;
+	cu.first_subprogram = builder.subprograms.size();
+	index_subprograms(dbg, cu_die, builder);
+	cu.num_subprograms = builder.subprograms.size() - cu.first_subprogram;
+	builder.cus.push_back(cu);
+}
+
+static void build_debug_index(Dwarf_Debug dbg, struct index_builder &builder) {
+	Dwarf_Error de;
+	// The pool is never empty, so it always ends with a NUL
+	builder.add_string("");
+	reset_cu(dbg);
+	while (dbg_step_cu(dbg) == DW_DLV_OK) {
+		Dwarf_Die die = NULL, ret_die = NULL;
+		Dwarf_Half tag;
+		while (dwarf_siblingof(dbg, die, &ret_die, &de) == DW_DLV_OK) {
+			if (die != NULL)
+				dwarf_dealloc(dbg, die, DW_DLA_DIE);
+			die = ret_die;
+			if (dwarf_tag(die, &tag, &de) == DW_DLV_OK && tag == DW_TAG_compile_unit) {
+				index_cu_die(dbg, die, builder);
+				break;
+			}
+		}
+		if (die != NULL)
+			dwarf_dealloc(dbg, die, DW_DLA_DIE);
+	}
+	std::vector<struct index_range> cus;
+	for (uint32_t i = 0; i < builder.cus.size(); i++)
+		cus.push_back(make_range(builder.cus[i].low, builder.cus[i].high, i));
+	disjoint_ranges(cus, builder.cu_ranges);
+}
+
+static size_t align_offset(size_t offset) {
+	return (offset + 7) & ~(size_t)7;
+}
+
+static std::vector<char> serialize_debug_index(const std::string &build_id, const struct index_builder &builder) {
+	struct index_file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "D2XI", 4);
+	header.version = D2X_INDEX_VERSION;
+	header.build_id_len = build_id.size();
+	memcpy(header.build_id, build_id.data(), build_id.size());
+	header.num_cus = builder.cus.size();
+	header.num_cu_ranges = builder.cu_ranges.size();
+	header.num_lines = builder.lines.size();
+	header.num_line_ranges = builder.line_ranges.size();
+	header.num_subprograms = builder.subprograms.size();
+	header.num_vars = builder.vars.size();
+	header.strings_size = builder.strings.size();
+
+	size_t offset = align_offset(sizeof(header));
+	header.cus_offset = offset;
+	offset = align_offset(offset + builder.cus.size() * sizeof(struct index_cu));
+	header.cu_ranges_offset = offset;
+	offset = align_offset(offset + builder.cu_ranges.size() * sizeof(struct index_range));
+	header.lines_offset = offset;
+	offset = align_offset(offset + builder.lines.size() * sizeof(struct index_line));
+	header.line_ranges_offset = offset;
+	offset = align_offset(offset + builder.line_ranges.size() * sizeof(struct index_range));
+	header.subprograms_offset = offset;
+	offset = align_offset(offset + builder.subprograms.size() * sizeof(struct index_subprogram));
+	header.vars_offset = offset;
+	offset = align_offset(offset + builder.vars.size() * sizeof(struct index_var));
+	header.strings_offset = offset;
+	offset += builder.strings.size();
+
+	std::vector<char> data(offset, 0);
+	memcpy(&data[0], &header, sizeof(header));
+	if (!builder.cus.empty())
+		memcpy(&data[header.cus_offset], builder.cus.data(), builder.cus.size() * sizeof(struct index_cu));
+	if (!builder.cu_ranges.empty())
+		memcpy(&data[header.cu_ranges_offset], builder.cu_ranges.data(), builder.cu_ranges.size() * sizeof(struct index_range));
+	if (!builder.lines.empty())
+		memcpy(&data[header.lines_offset], builder.lines.data(), builder.lines.size() * sizeof(struct index_line));
+	if (!builder.line_ranges.empty())
+		memcpy(&data[header.line_ranges_offset], builder.line_ranges.data(), 
+			builder.line_ranges.size() * sizeof(struct index_range));
+	if (!builder.subprograms.empty())
+		memcpy(&data[header.subprograms_offset], builder.subprograms.data(), 
+			builder.subprograms.size() * sizeof(struct index_subprogram));
+	if (!builder.vars.empty())
+		memcpy(&data[header.vars_offset], builder.vars.data(), builder.vars.size() * sizeof(struct index_var));
+	if (!builder.strings.empty())
+		memcpy(&data[header.strings_offset], builder.strings.data(), builder.strings.size());
+	return data;
+}
+
+// A table of count entries at offset lies in the data and is aligned for its entries
+static bool table_in_bounds(const struct debug_index* index, uint64_t offset, uint64_t count, size_t entry_size) {
+	return offset % 8 == 0 && offset <= index->size && count <= (index->size - offset) / entry_size;
+}
+
+// Every index into another table or the string pool is in bounds, so lookups never read 
+// outside the data whatever a corrupt or truncated cache file holds
+static bool check_debug_index(const struct debug_index* index) {
+	const struct index_file_header* header = index->header;
+	const char* strings = index->strings;
+	uint32_t strings_size = header->strings_size;
+	if (strings_size == 0 || strings[strings_size - 1] != 0)
+		return false;
+	for (uint32_t i = 0; i < header->num_cus; i++) {
+		const struct index_cu &cu = index->cus[i];
+		if (cu.first_line > header->num_lines || cu.num_lines > header->num_lines - cu.first_line
+				|| cu.first_line_range > header->num_line_ranges 
+				|| cu.num_line_ranges > header->num_line_ranges - cu.first_line_range
+				|| cu.first_subprogram > header->num_subprograms 
+				|| cu.num_subprograms > header->num_subprograms - cu.first_subprogram)
+			return false;
+		for (uint32_t r = cu.first_line_range; r < cu.first_line_range + cu.num_line_ranges; r++) {
+			if (index->line_ranges[r].value < cu.first_line || index->line_ranges[r].value - cu.first_line >= cu.num_lines)
+				return false;
+		}
+	}
+	for (uint32_t i = 0; i < header->num_cu_ranges; i++) {
+		if (index->cu_ranges[i].value >= header->num_cus)
+			return false;
+	}
+	for (uint32_t i = 0; i < header->num_lines; i++) {
+		if (index->lines[i].file >= strings_size)
+			return false;
+	}
+	for (uint32_t i = 0; i < header->num_subprograms; i++) {
+		const struct index_subprogram &sub = index->subprograms[i];
+		if (sub.name >= strings_size || sub.linkage >= strings_size
+				|| sub.first_var > header->num_vars || sub.num_vars > header->num_vars - sub.first_var)
+			return false;
+	}
+	for (uint32_t i = 0; i < header->num_vars; i++) {
+		if (index->vars[i].name >= strings_size)
+			return false;
+	}
+	return true;
+}
+
+// Sets up the table pointers, false if the data is not a valid index for build_id
+static bool attach_debug_index(struct debug_index* index, const std::string &build_id) {
+	if (index->size < sizeof(struct index_file_header))
+		return false;
+	const struct index_file_header* header = (const struct index_file_header*) index->data;
+	if (memcmp(header->magic, "D2XI", 4) != 0 || header->version != D2X_INDEX_VERSION 
+			|| header->build_id_len != build_id.size() 
+			|| memcmp(header->build_id, build_id.data(), build_id.size()) != 0)
+		return false;
+	if (!table_in_bounds(index, header->cus_offset, header->num_cus, sizeof(struct index_cu))
+			|| !table_in_bounds(index, header->cu_ranges_offset, header->num_cu_ranges, sizeof(struct index_range))
+			|| !table_in_bounds(index, header->lines_offset, header->num_lines, sizeof(struct index_line))
+			|| !table_in_bounds(index, header->line_ranges_offset, header->num_line_ranges, sizeof(struct index_range))
+			|| !table_in_bounds(index, header->subprograms_offset, header->num_subprograms, sizeof(struct index_subprogram))
+			|| !table_in_bounds(index, header->vars_offset, header->num_vars, sizeof(struct index_var))
+			|| header->strings_offset > index->size || header->strings_size > index->size - header->strings_offset)
+		return false;
+	index->header = header;
+	index->cus = (const struct index_cu*) (index->data + header->cus_offset);
+	index->cu_ranges = (const struct index_range*) (index->data + header->cu_ranges_offset);
+	index->lines = (const struct index_line*) (index->data + header->lines_offset);
+	index->line_ranges = (const struct index_range*) (index->data + header->line_ranges_offset);
+	index->subprograms = (const struct index_subprogram*) (index->data + header->subprograms_offset);
+	index->vars = (const struct index_var*) (index->data + header->vars_offset);
+	index->strings = index->data + header->strings_offset;
+	return check_debug_index(index);
+}
+
+static struct debug_index* map_debug_index(const std::string &path, const std::string &build_id) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return nullptr;
+	}
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return nullptr;
+	struct debug_index* index = new struct debug_index();
+	index->data = (const char*) data;
+	index->size = st.st_size;
+	index->mapped = true;
+	if (!attach_debug_index(index, build_id)) {
+		munmap(data, st.st_size);
+		delete index;
+		return nullptr;
+	}
+	return index;
+}
+
+static void load_debug_index(const char* filename, Dwarf_Debug dbg) {
+	const char* enabled = getenv("D2X_INDEX_CACHE");
+	if (enabled != NULL && strcmp(enabled, "0") == 0)
+		return;
+	std::string build_id;
+	if (!read_build_id(filename, build_id))
+		return;
+	std::stringstream name;
+	for (unsigned char c: build_id)
+		name << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 15];
+	std::string dir = index_cache_dir();
+	std::string path = dir + "/" + name.str() + ".idx";
+
+	struct debug_index* index = dir == "" ? nullptr : map_debug_index(path, build_id);
+	if (index == nullptr) {
+		struct index_builder builder;
+		build_debug_index(dbg, builder);
+		std::vector<char> data = serialize_debug_index(build_id, builder);
+		// Other processes may be writing the same index, the rename makes the file 
+		// appear complete
+		if (dir != "") {
+			make_dirs(dir);
+			std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+			bool written;
+			{
+				std::ofstream out(tmp_path, std::ios::binary);
+				written = (bool) out.write(data.data(), data.size());
+			}
+			if (written && rename(tmp_path.c_str(), path.c_str()) == 0)
+				index = map_debug_index(path, build_id);
+			else
+				unlink(tmp_path.c_str());
+		}
+		// The cache directory is not writable, keep the index for this process only
+		if (index == nullptr) {
+			index = new struct debug_index();
+			index->buffer.swap(data);
+			index->data = index->buffer.data();
+			index->size = index->buffer.size();
+			index->mapped = false;
+			if (!attach_debug_index(index, build_id)) {
+				delete index;
+				return;
+			}
+		}
+	}
+	debug_index_map[dbg] = index;
+}
+
+static void release_debug_index(Dwarf_Debug dbg) {
+	auto it = debug_index_map.find(dbg);
+	if (it == debug_index_map.end())
+		return;
+	if (it->second->mapped)
+		munmap((void*) it->second->data, it->second->size);
+	delete it->second;
+	debug_index_map.erase(it);
+}
+
+static const struct index_range* index_find_range(const struct index_range* ranges, uint32_t count, uint64_t addr) {
+	const struct index_range* it = std::upper_bound(ranges, ranges + count, addr, 
+		[](uint64_t a, const struct index_range &r) { return a < r.low; });
+	if (it == ranges || addr >= (it - 1)->high)
+		return nullptr;
+	return it - 1;
+}
+
+// First CU containing addr, in the order of the CU headers
+static const struct index_cu* index_find_cu(const struct debug_index* index, uint64_t addr) {
+	const struct index_range* range = index_find_range(index->cu_ranges, index->header->num_cu_ranges, addr);
+	if (range == nullptr)
+		return nullptr;
+	return &index->cus[range->value];
+}
+
+static void index_find_line_info(const struct debug_index* index, uint64_t addr, int *line_no, const char** fname, 
+		std::string &function_name, std::string &linkage_name) {
+	const struct index_cu* cu = index_find_cu(index, addr);
+	if (cu == nullptr)
+		return;
+	const struct index_range* row = index_find_range(index->line_ranges + cu->first_line_range, cu->num_line_ranges, addr);
+	if (row == nullptr)
+		return;
+	*line_no = index->lines[row->value].line;
+	*fname = index->strings + index->lines[row->value].file;
+	for (uint32_t i = cu->first_subprogram; i < cu->first_subprogram + cu->num_subprograms; i++) {
+		const struct index_subprogram &sub = index->subprograms[i];
+		if (addr >= sub.low && addr < sub.high) {
+			function_name = index->strings + sub.name;
+			linkage_name = index->strings + sub.linkage;
+			return;
+		}
+	}
+}
+
+bool has_debug_index(Dwarf_Debug dbg) {
+	return debug_index_map.find(dbg) != debug_index_map.end();
+}
+
+int find_var_die_offset(Dwarf_Debug dbg, uint64_t pc, const char* varname, Dwarf_Off* ret) {
+	auto it = debug_index_map.find(dbg);
+	if (it == debug_index_map.end())
+		return -1;
+	const struct debug_index* index = it->second;
+	const struct index_cu* cu = index_find_cu(index, pc);
+	if (cu == nullptr)
+		return -1;
+	for (uint32_t i = cu->first_subprogram; i < cu->first_subprogram + cu->num_subprograms; i++) {
+		const struct index_subprogram &sub = index->subprograms[i];
+		if (pc < sub.low || pc >= sub.high)
+			continue;
+		for (uint32_t v = sub.first_var; v < sub.first_var + sub.num_vars; v++) {
+			if (strcmp(index->strings + index->vars[v].name, varname) == 0) {
+				*ret = index->vars[v].die_offset;
+				return 0;
+			}
+		}
+	}
+	return -1;
+}
+
 void find_line_info_with_dbg(Dwarf_Debug dbg, uint64_t addr, int *line_no, const char** fname, std::string &function_name, std::string &linkage_name) {
 	*line_no = -1;
 	*fname = NULL;
+	auto index = debug_index_map.find(dbg);
+	if (index != debug_index_map.end()) {
+		index_find_line_info(index->second, addr, line_no, fname, function_name, linkage_name);
+		return;
+	}
 	Dwarf_Die cu_die = find_cu_die(dbg, addr);
 	Dwarf_Error de;
 	if (cu_die == NULL)
@@ -231,6 +1042,225 @@ cleanup:
 
 
 
+std::string normalize_path(const std::string &path, const std::string &base_dir) {
+	std::string full = path;
+	if (!path.empty() && path[0] != '/' && !base_dir.empty())
+		full = base_dir + "/" + path;
+	bool absolute = !full.empty() && full[0] == '/';
+	std::vector<std::string> parts;
+	std::stringstream ss(full);
+	std::string part;
+	while (std::getline(ss, part, '/')) {
+		if (part.empty() || part == ".")
+			continue;
+		// Leading .. of relative paths cannot be resolved
+		if (part == ".." && !parts.empty() && parts.back() != "..")
+			parts.pop_back();
+		else if (part != ".." || !absolute)
+			parts.push_back(part);
+	}
+	std::string ret = absolute ? "/" : "";
+	for (size_t i = 0; i < parts.size(); i++)
+		ret += (i ? "/" : "") + parts[i];
+	return ret;
+}
+
+// Whether addr is in the address ranges of die, has_range is set to false if die has none
+static bool die_contains_pc(Dwarf_Debug dbg, Dwarf_Die die, Dwarf_Half version, Dwarf_Unsigned cu_base, 
+		uint64_t addr, bool* has_range) {
+	Dwarf_Unsigned lopc, hipc;
+	*has_range = true;
+	if (die_pc_range(die, &lopc, &hipc))
+		return addr >= lopc && addr < hipc;
+	Dwarf_Error de;
+	Dwarf_Attribute at;
+	if (dwarf_attr(die, DW_AT_ranges, &at, &de) != DW_DLV_OK) {
+		*has_range = false;
+		return false;
+	}
+	bool found = false;
+	if (version >= 5) {
+		// Cooked entries of .debug_rnglists already have the base address applied
+		Dwarf_Half form;
+		Dwarf_Unsigned value, count, global_offset;
+		Dwarf_Off offset;
+		Dwarf_Rnglists_Head head;
+		if (dwarf_whatform(at, &form, &de) != DW_DLV_OK)
+			return false;
+		if (form == DW_FORM_rnglistx) {
+			if (dwarf_formudata(at, &value, &de) != DW_DLV_OK)
+				return false;
+		} else {
+			if (dwarf_global_formref(at, &offset, &de) != DW_DLV_OK)
+				return false;
+			value = offset;
+		}
+		if (dwarf_rnglists_get_rle_head(at, form, value, &head, &count, &global_offset, &de) != DW_DLV_OK)
+			return false;
+		for (Dwarf_Unsigned i = 0; i < count && !found; i++) {
+			unsigned int entry_len, code;
+			Dwarf_Unsigned raw1, raw2, cooked1, cooked2;
+			Dwarf_Bool unavailable;
+			if (dwarf_get_rnglists_entry_fields_a(head, i, &entry_len, &code, &raw1, &raw2, &unavailable, 
+					&cooked1, &cooked2, &de) != DW_DLV_OK)
+				break;
+			if (code == DW_RLE_end_of_list || code == DW_RLE_base_address || code == DW_RLE_base_addressx || unavailable)
+				continue;
+			found = addr >= cooked1 && addr < cooked2;
+		}
+		dwarf_dealloc_rnglists_head(head);
+	} else {
+		// Entries of .debug_ranges are relative to the CU base address unless a base address 
+		// selection entry changes it
+		Dwarf_Off offset;
+		Dwarf_Ranges* ranges;
+		Dwarf_Signed count;
+		Dwarf_Unsigned bytes;
+		if (dwarf_global_formref(at, &offset, &de) != DW_DLV_OK)
+			return false;
+		if (dwarf_get_ranges_a(dbg, offset, die, &ranges, &count, &bytes, &de) != DW_DLV_OK)
+			return false;
+		Dwarf_Unsigned base = cu_base;
+		for (Dwarf_Signed i = 0; i < count && !found; i++) {
+			if (ranges[i].dwr_type == DW_RANGES_END)
+				break;
+			if (ranges[i].dwr_type == DW_RANGES_ADDRESS_SELECTION) {
+				base = ranges[i].dwr_addr2;
+				continue;
+			}
+			found = addr >= base + ranges[i].dwr_addr1 && addr < base + ranges[i].dwr_addr2;
+		}
+		dwarf_ranges_dealloc(dbg, ranges, count);
+	}
+	return found;
+}
+
+// File names of call sites are kept for the lifetime of the process like those from the line tables
+static std::set<std::string> call_site_files;
+
+struct inline_walk {
+	Dwarf_Debug dbg;
+	uint64_t addr;
+	Dwarf_Half version;
+	Dwarf_Unsigned cu_base;
+	char** files;
+	Dwarf_Signed file_count;
+};
+
+// Descends into the children of die containing addr, recording the call site of each 
+// inlined subroutine on the way, outermost first. Returns true once the subprogram containing 
+// addr has been walked
+static bool walk_inline_chain(const struct inline_walk &walk, Dwarf_Die die, std::vector<std::pair<const char*, int>> &call_sites) {
+	Dwarf_Error de;
+	Dwarf_Die child;
+	if (dwarf_child(die, &child, &de) != DW_DLV_OK)
+		return false;
+	bool done = false;
+	while (!done) {
+		Dwarf_Half tag;
+		bool has_range;
+		if (dwarf_tag(child, &tag, &de) == DW_DLV_OK) {
+			bool contains = die_contains_pc(walk.dbg, child, walk.version, walk.cu_base, walk.addr, &has_range);
+			if (contains && tag == DW_TAG_inlined_subroutine) {
+				Dwarf_Attribute at;
+				Dwarf_Unsigned file = 0, line = 0;
+				if (dwarf_attr(child, DW_AT_call_file, &at, &de) == DW_DLV_OK)
+					dwarf_formudata(at, &file, &de);
+				if (dwarf_attr(child, DW_AT_call_line, &at, &de) == DW_DLV_OK)
+					dwarf_formudata(at, &line, &de);
+				// File indices start at 1 before DWARF 5
+				Dwarf_Signed index = walk.version >= 5 ? (Dwarf_Signed) file : (Dwarf_Signed) file - 1;
+				if (index >= 0 && index < walk.file_count && line > 0) {
+					const char* name = call_site_files.insert(walk.files[index]).first->c_str();
+					call_sites.push_back(std::make_pair(name, (int) line));
+				}
+			}
+			if (contains && (tag == DW_TAG_subprogram || tag == DW_TAG_lexical_block || tag == DW_TAG_inlined_subroutine)) {
+				walk_inline_chain(walk, child, call_sites);
+				// Blocks at one level do not overlap
+				done = true;
+			} else if (!has_range && tag == DW_TAG_namespace)
+				done = walk_inline_chain(walk, child, call_sites);
+		}
+		Dwarf_Die sibling = NULL;
+		if (!done && dwarf_siblingof(walk.dbg, child, &sibling, &de) != DW_DLV_OK)
+			sibling = NULL;
+		dwarf_dealloc(walk.dbg, child, DW_DLA_DIE);
+		if (sibling == NULL)
+			break;
+		child = sibling;
+	}
+	return done;
+}
+
+void find_inline_call_sites(Dwarf_Debug dbg, uint64_t addr, std::vector<std::pair<const char*, int>> &call_sites) {
+	call_sites.clear();
+	Dwarf_Die cu_die = find_cu_die(dbg, addr);
+	if (cu_die == NULL)
+		return;
+	Dwarf_Error de;
+	struct inline_walk walk;
+	walk.dbg = dbg;
+	walk.addr = addr;
+	walk.files = NULL;
+	walk.file_count = 0;
+	Dwarf_Half offset_size;
+	if (dwarf_get_version_of_die(cu_die, &walk.version, &offset_size) != DW_DLV_OK)
+		walk.version = 4;
+	if (dwarf_lowpc(cu_die, &walk.cu_base, &de) != DW_DLV_OK)
+		walk.cu_base = 0;
+	if (dwarf_srcfiles(cu_die, &walk.files, &walk.file_count, &de) == DW_DLV_OK) {
+		walk_inline_chain(walk, cu_die, call_sites);
+		for (Dwarf_Signed i = 0; i < walk.file_count; i++)
+			dwarf_dealloc(dbg, walk.files[i], DW_DLA_STRING);
+		dwarf_dealloc(dbg, walk.files, DW_DLA_LIST);
+	}
+	std::reverse(call_sites.begin(), call_sites.end());
+	dwarf_dealloc(dbg, cu_die, DW_DLA_DIE);
+	reset_cu(dbg);
+}
+
+// CUs may cover their code with ranges, e.g. when functions are placed in several text sections
+std::string find_comp_dir(Dwarf_Debug dbg, uint64_t addr, const char* cu_name) {
+	std::string comp_dir, named_comp_dir;
+	bool found = false, named = false;
+	Dwarf_Error de;
+	while (!found && dbg_step_cu(dbg) == DW_DLV_OK) {
+		Dwarf_Die cu_die;
+		Dwarf_Half tag;
+		if (dwarf_siblingof(dbg, NULL, &cu_die, &de) != DW_DLV_OK)
+			continue;
+		if (dwarf_tag(cu_die, &tag, &de) == DW_DLV_OK && tag == DW_TAG_compile_unit) {
+			Dwarf_Half version, offset_size;
+			Dwarf_Unsigned cu_base;
+			bool has_range;
+			if (dwarf_get_version_of_die(cu_die, &version, &offset_size) != DW_DLV_OK)
+				version = 4;
+			if (dwarf_lowpc(cu_die, &cu_base, &de) != DW_DLV_OK)
+				cu_base = 0;
+			Dwarf_Attribute at;
+			char* dir = NULL;
+			if (dwarf_attr(cu_die, DW_AT_comp_dir, &at, &de) != DW_DLV_OK || dwarf_formstring(at, &dir, &de) != DW_DLV_OK)
+				dir = NULL;
+			char* name = NULL;
+			if (die_contains_pc(dbg, cu_die, version, cu_base, addr, &has_range)) {
+				comp_dir = dir != NULL ? dir : "";
+				found = true;
+			} else if (!named && cu_name != NULL && dwarf_diename(cu_die, &name, &de) == DW_DLV_OK 
+					&& strcmp(name, cu_name) == 0) {
+				named_comp_dir = dir != NULL ? dir : "";
+				named = true;
+			}
+		}
+		dwarf_dealloc(dbg, cu_die, DW_DLA_DIE);
+	}
+	if (found) {
+		reset_cu(dbg);
+		return comp_dir;
+	}
+	return named_comp_dir;
+}
+
 int find_line_info(uint64_t addr, int* line_no, const char** filename, std::string &function_name, std::string &linkage_name) {
 	*line_no = -1;
 	*filename = NULL;
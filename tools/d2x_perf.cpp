@@ -0,0 +1,593 @@
+#include "d2x_runtime/d2x_runtime_core.h"
+#include "d2x/utils.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <elf.h>
+#include <cxxabi.h>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <map>
+#include <set>
+#include <vector>
+#include <thread>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+/* d2x-perf attributes perf samples to DSL extended stacks without running the program.
+The function headers are read from the D2X_entry section of the binary, following the tables
+through the relocations the dynamic loader would apply. Sample addresses are mapped to
+generated lines with the DWARF line tables and then to the DSL stacks of those lines.
+
+Usage: d2x-perf <binary> [options] < input
+	--raw			input has one sample per line as hex addresses in the binary, innermost first
+	--flat <file>		write the flat profile to file instead of stdout
+	--folded <file>		write folded stacks for flame graphs to file
+	--dsl-only		leave frames outside DSL sections out of the folded stacks
+	--threads <n>		number of threads symbolizing addresses
+
+Without --raw the input is the output of perf script, optionally with --show-mmap-events */
+
+namespace d2x {
+namespace perf {
+
+// The parts of a binary needed to read the tables and to translate sample addresses
+struct elf_file {
+	std::vector<char> data;
+	const Elf64_Ehdr* ehdr;
+	const Elf64_Shdr* shdrs;
+	const Elf64_Phdr* phdrs;
+	// R_X86_64_RELATIVE relocations, offset to addend
+	std::map<uint64_t, uint64_t> relocs;
+	std::map<std::string, uint64_t> symbols;
+};
+
+// A section header as read from the binary with all pointers resolved
+struct static_section {
+	uint64_t function_addr;
+	std::string identified_filename;
+	int identified_line;
+	std::vector<struct runtime::d2x_source_stack> source_table;
+	std::vector<struct runtime::d2x_source_loc> source_list;
+	std::vector<std::string> strings;
+};
+
+struct native_frame {
+	bool in_binary;
+	uint64_t vaddr; // adjusted to the calling instruction for callers
+	std::string symbol;
+};
+
+struct sample {
+	std::vector<struct native_frame> frames; // innermost first
+};
+
+struct generated_line {
+	std::string filename;
+	int line;
+};
+
+static bool vaddr_to_offset(const struct elf_file &elf, uint64_t vaddr, uint64_t &offset) {
+	for (int i = 0; i < elf.ehdr->e_phnum; i++) {
+		const Elf64_Phdr &ph = elf.phdrs[i];
+		if (ph.p_type == PT_LOAD && vaddr >= ph.p_vaddr && vaddr < ph.p_vaddr + ph.p_filesz) {
+			offset = vaddr - ph.p_vaddr + ph.p_offset;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool offset_to_vaddr(const struct elf_file &elf, uint64_t offset, uint64_t &vaddr) {
+	for (int i = 0; i < elf.ehdr->e_phnum; i++) {
+		const Elf64_Phdr &ph = elf.phdrs[i];
+		if (ph.p_type == PT_LOAD && offset >= ph.p_offset && offset < ph.p_offset + ph.p_filesz) {
+			vaddr = offset - ph.p_offset + ph.p_vaddr;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool read_bytes(const struct elf_file &elf, uint64_t vaddr, void* buffer, size_t size) {
+	uint64_t offset;
+	if (!vaddr_to_offset(elf, vaddr, offset) || offset + size > elf.data.size())
+		return false;
+	memcpy(buffer, &elf.data[offset], size);
+	return true;
+}
+
+// Pointers in position independent binaries are only filled in by relocations
+static uint64_t read_pointer(const struct elf_file &elf, uint64_t vaddr) {
+	auto reloc = elf.relocs.find(vaddr);
+	if (reloc != elf.relocs.end())
+		return reloc->second;
+	uint64_t value = 0;
+	read_bytes(elf, vaddr, &value, sizeof(value));
+	return value;
+}
+
+static std::string read_string(const struct elf_file &elf, uint64_t vaddr) {
+	uint64_t offset;
+	if (vaddr == 0 || !vaddr_to_offset(elf, vaddr, offset) || offset >= elf.data.size())
+		return "";
+	size_t end = offset;
+	while (end < elf.data.size() && elf.data[end] != 0)
+		end++;
+	return std::string(&elf.data[offset], end - offset);
+}
+
+static std::string demangle(const char* name) {
+	int status;
+	char* demangled = abi::__cxa_demangle(name, NULL, NULL, &status);
+	if (demangled == NULL)
+		return name;
+	std::string ret = demangled;
+	free(demangled);
+	return ret;
+}
+
+static bool section_in_file(const struct elf_file &elf, const Elf64_Shdr &sh) {
+	return sh.sh_type != SHT_NOBITS && sh.sh_offset <= elf.data.size() && sh.sh_size <= elf.data.size() - sh.sh_offset;
+}
+
+static bool load_elf(const char* filename, struct elf_file &elf) {
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+		return false;
+	elf.data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	if (elf.data.size() < sizeof(Elf64_Ehdr))
+		return false;
+	elf.ehdr = (const Elf64_Ehdr*) &elf.data[0];
+	if (memcmp(elf.ehdr->e_ident, ELFMAG, SELFMAG) != 0 || elf.ehdr->e_ident[EI_CLASS] != ELFCLASS64)
+		return false;
+	if (elf.ehdr->e_shoff > elf.data.size() || elf.ehdr->e_shnum > (elf.data.size() - elf.ehdr->e_shoff) / sizeof(Elf64_Shdr)
+			|| elf.ehdr->e_phoff > elf.data.size() || elf.ehdr->e_phnum > (elf.data.size() - elf.ehdr->e_phoff) / sizeof(Elf64_Phdr)
+			|| elf.ehdr->e_shstrndx >= elf.ehdr->e_shnum)
+		return false;
+	elf.shdrs = (const Elf64_Shdr*) &elf.data[elf.ehdr->e_shoff];
+	elf.phdrs = (const Elf64_Phdr*) &elf.data[elf.ehdr->e_phoff];
+	if (!section_in_file(elf, elf.shdrs[elf.ehdr->e_shstrndx]))
+		return false;
+
+	for (int i = 0; i < elf.ehdr->e_shnum; i++) {
+		const Elf64_Shdr &sh = elf.shdrs[i];
+		// Sections whose contents are not in the file are skipped
+		if ((sh.sh_type == SHT_RELA || sh.sh_type == SHT_SYMTAB || sh.sh_type == SHT_DYNSYM) && !section_in_file(elf, sh))
+			continue;
+		if (sh.sh_type == SHT_RELA) {
+			const Elf64_Rela* relas = (const Elf64_Rela*) &elf.data[sh.sh_offset];
+			for (size_t r = 0; r < sh.sh_size / sizeof(Elf64_Rela); r++) {
+				if (ELF64_R_TYPE(relas[r].r_info) == R_X86_64_RELATIVE)
+					elf.relocs[relas[r].r_offset] = relas[r].r_addend;
+			}
+		} else if (sh.sh_type == SHT_SYMTAB || sh.sh_type == SHT_DYNSYM) {
+			if (sh.sh_link >= elf.ehdr->e_shnum || !section_in_file(elf, elf.shdrs[sh.sh_link]))
+				continue;
+			const Elf64_Shdr &strsh = elf.shdrs[sh.sh_link];
+			const Elf64_Sym* syms = (const Elf64_Sym*) &elf.data[sh.sh_offset];
+			const char* strtab = &elf.data[strsh.sh_offset];
+			for (size_t s = 0; s < sh.sh_size / sizeof(Elf64_Sym); s++) {
+				if (ELF64_ST_TYPE(syms[s].st_info) != STT_FUNC || syms[s].st_value == 0)
+					continue;
+				// Names must end with a NUL inside the string table
+				if (syms[s].st_name >= strsh.sh_size || memchr(strtab + syms[s].st_name, 0, strsh.sh_size - syms[s].st_name) == NULL)
+					continue;
+				const char* name = strtab + syms[s].st_name;
+				elf.symbols[name] = syms[s].st_value;
+				elf.symbols[demangle(name)] = syms[s].st_value;
+			}
+		}
+	}
+	return true;
+}
+
+static bool table_fits(const struct elf_file &elf, int len, size_t entry_size) {
+	return len >= 0 && (uint64_t) len <= elf.data.size() / entry_size;
+}
+
+static std::vector<struct static_section> read_sections(const struct elf_file &elf) {
+	using runtime::d2x_function_header;
+	std::vector<struct static_section> sections;
+	// The section name table was checked to be in the file by load_elf
+	const Elf64_Shdr &strsh = elf.shdrs[elf.ehdr->e_shstrndx];
+	const char* shstrtab = &elf.data[strsh.sh_offset];
+	for (int i = 0; i < elf.ehdr->e_shnum; i++) {
+		const Elf64_Shdr &sh = elf.shdrs[i];
+		if (sh.sh_name >= strsh.sh_size || strsh.sh_size - sh.sh_name < sizeof("D2X_entry") 
+				|| strcmp(shstrtab + sh.sh_name, "D2X_entry") != 0)
+			continue;
+		for (uint64_t h = sh.sh_addr; h + sizeof(d2x_function_header) <= sh.sh_addr + sh.sh_size;
+				h += sizeof(d2x_function_header)) {
+			d2x_function_header header;
+			if (!read_bytes(elf, h, &header, sizeof(header)))
+				break;
+			struct static_section section;
+			section.function_addr = read_pointer(elf, h + offsetof(d2x_function_header, function_addr));
+			section.identified_filename = read_string(elf, read_pointer(elf, h + offsetof(d2x_function_header, identified_filename)));
+			section.identified_line = header.identified_line;
+
+			// Tables cannot be larger than the file they are read from, skip headers that claim so
+			if (!table_fits(elf, header.source_table_len, sizeof(struct runtime::d2x_source_stack))
+					|| !table_fits(elf, header.source_list_len, sizeof(struct runtime::d2x_source_loc))
+					|| !table_fits(elf, header.string_table_len, sizeof(uint64_t)))
+				continue;
+			uint64_t source_table = read_pointer(elf, h + offsetof(d2x_function_header, source_table));
+			section.source_table.resize(header.source_table_len);
+			if (!read_bytes(elf, source_table, section.source_table.data(), header.source_table_len * sizeof(struct runtime::d2x_source_stack)))
+				continue;
+			uint64_t source_list = read_pointer(elf, h + offsetof(d2x_function_header, source_list));
+			section.source_list.resize(header.source_list_len);
+			if (!read_bytes(elf, source_list, section.source_list.data(), header.source_list_len * sizeof(struct runtime::d2x_source_loc)))
+				continue;
+			uint64_t string_table = read_pointer(elf, h + offsetof(d2x_function_header, string_table));
+			for (int s = 0; s < header.string_table_len; s++)
+				section.strings.push_back(read_string(elf, read_pointer(elf, string_table + s * sizeof(uint64_t))));
+			sections.push_back(section);
+		}
+	}
+	return sections;
+}
+
+static std::string basename(const std::string &path) {
+	size_t pos = path.find_last_of('/');
+	return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+// Symbolizes a sorted batch of addresses with a libdwarf handle private to the calling thread
+static void symbolize_batch(const char* binary, const std::vector<uint64_t> &addrs, size_t begin, size_t end,
+		std::vector<struct generated_line> &lines) {
+	int fd = open(binary, O_RDONLY);
+	if (fd < 0)
+		return;
+	Dwarf_Debug dbg;
+	Dwarf_Error de;
+	if (dwarf_init(fd, DW_DLC_READ, NULL, NULL, &dbg, &de)) {
+		close(fd);
+		return;
+	}
+	for (size_t i = begin; i < end; i++) {
+		int line_no = -1;
+		const char* fname = NULL;
+		std::string func_name, linkage_name;
+		util::find_line_info_with_dbg(dbg, addrs[i], &line_no, &fname, func_name, linkage_name);
+		if (line_no != -1 && fname != NULL) {
+			lines[i].filename = fname;
+			lines[i].line = line_no;
+		}
+	}
+	dwarf_finish(dbg, &de);
+	close(fd);
+}
+
+struct mapping {
+	uint64_t start;
+	uint64_t len;
+	uint64_t pgoff;
+};
+
+// Parses "<ip> <sym>[+<off>] (<dso>)"
+static bool parse_frame(const std::string &text, uint64_t &ip, std::string &symbol, uint64_t &offset, std::string &dso) {
+	std::stringstream ss(text);
+	std::string ip_str;
+	if (!(ss >> ip_str))
+		return false;
+	char* end;
+	ip = strtoull(ip_str.c_str(), &end, 16);
+	if (*end != 0)
+		return false;
+	std::string rest;
+	std::getline(ss, rest);
+	size_t dso_start = rest.rfind(" (");
+	if (dso_start == std::string::npos || rest.back() != ')')
+		return false;
+	dso = rest.substr(dso_start + 2, rest.size() - dso_start - 3);
+	symbol = rest.substr(0, dso_start);
+	symbol.erase(0, symbol.find_first_not_of(" \t"));
+	offset = 0;
+	size_t plus = symbol.rfind("+0x");
+	if (plus != std::string::npos) {
+		offset = strtoull(symbol.c_str() + plus + 3, NULL, 16);
+		symbol = symbol.substr(0, plus);
+	}
+	return true;
+}
+
+static bool parse_mmap(const std::string &line, std::string &dso, struct mapping &m) {
+	size_t open_bracket = line.find("[0x");
+	if (open_bracket == std::string::npos)
+		return false;
+	if (sscanf(line.c_str() + open_bracket, "[0x%lx(0x%lx) @ 0x%lx", &m.start, &m.len, &m.pgoff) != 3)
+		return false;
+	size_t last_space = line.find_last_of(' ');
+	dso = line.substr(last_space + 1);
+	return true;
+}
+
+class perf_reader {
+	const struct elf_file &elf;
+	std::string binary_name;
+	std::vector<struct mapping> mappings;
+public:
+	std::vector<struct sample> samples;
+
+	perf_reader(const struct elf_file &elf, const std::string &binary): elf(elf), binary_name(basename(binary)) {}
+
+	struct native_frame resolve(const std::string &text, bool caller) {
+		struct native_frame frame;
+		frame.in_binary = false;
+		uint64_t ip, offset;
+		std::string symbol, dso;
+		if (!parse_frame(text, ip, symbol, offset, dso)) {
+			frame.symbol = "[unknown]";
+			return frame;
+		}
+		frame.symbol = symbol == "[unknown]" ? "[" + basename(dso) + "]" : symbol;
+		if (basename(dso) != binary_name)
+			return frame;
+		bool found = false;
+		for (auto &m: mappings) {
+			if (ip >= m.start && ip < m.start + m.len)
+				found = offset_to_vaddr(elf, ip - m.start + m.pgoff, frame.vaddr);
+		}
+		if (!found && elf.symbols.find(symbol) != elf.symbols.end()) {
+			frame.vaddr = elf.symbols.at(symbol) + offset;
+			found = true;
+		}
+		if (!found && elf.ehdr->e_type == ET_EXEC) {
+			frame.vaddr = ip;
+			found = true;
+		}
+		// Return addresses point after the call
+		if (found && caller)
+			frame.vaddr--;
+		frame.in_binary = found;
+		return frame;
+	}
+
+	void read_script(std::istream &input) {
+		std::string line;
+		std::string header;
+		bool in_sample = false;
+		struct sample current;
+		auto finish_sample = [&]() {
+			if (!in_sample)
+				return;
+			// Without callchains the sample line ends with the ip
+			if (current.frames.empty()) {
+				size_t colon = header.rfind(": ");
+				if (colon != std::string::npos) {
+					struct native_frame frame = resolve(header.substr(colon + 2), false);
+					if (frame.symbol != "[unknown]")
+						current.frames.push_back(frame);
+				}
+			}
+			samples.push_back(current);
+			current.frames.clear();
+			in_sample = false;
+		};
+		while (std::getline(input, line)) {
+			if (line.find("PERF_RECORD_MMAP") != std::string::npos) {
+				std::string dso;
+				struct mapping m;
+				if (parse_mmap(line, dso, m) && basename(dso) == binary_name)
+					mappings.push_back(m);
+				continue;
+			}
+			if (line.find("PERF_RECORD_") != std::string::npos)
+				continue;
+			if (line.empty()) {
+				finish_sample();
+				continue;
+			}
+			if (line[0] == ' ' || line[0] == '\t') {
+				if (in_sample)
+					current.frames.push_back(resolve(line, !current.frames.empty()));
+				continue;
+			}
+			finish_sample();
+			header = line;
+			in_sample = true;
+		}
+		finish_sample();
+	}
+
+	void read_raw(std::istream &input) {
+		std::string line;
+		while (std::getline(input, line)) {
+			std::stringstream ss(line);
+			std::string addr;
+			struct sample current;
+			while (ss >> addr) {
+				struct native_frame frame;
+				frame.in_binary = true;
+				frame.vaddr = strtoull(addr.c_str(), NULL, 16) - (current.frames.empty() ? 0 : 1);
+				frame.symbol = addr;
+				current.frames.push_back(frame);
+			}
+			if (!current.frames.empty())
+				samples.push_back(current);
+		}
+	}
+};
+
+// DSL frames for a generated line, outermost first. Empty if the line is not in a section
+static std::vector<std::string> dsl_frames(const std::vector<struct static_section> &sections,
+		const std::map<std::string, std::map<int, int>> &index, const struct generated_line &line) {
+	std::vector<std::string> frames;
+	auto file = index.find(util::normalize_path(line.filename, ""));
+	if (file != index.end()) {
+		auto it = file->second.upper_bound(line.line);
+		if (it == file->second.begin())
+			return frames;
+		--it;
+		const struct static_section &section = sections[it->second];
+		int offset = line.line - section.identified_line;
+		if (offset < 0 || offset >= (int) section.source_table.size())
+			return frames;
+		struct runtime::d2x_source_stack stack = section.source_table[offset];
+		if (stack.stack_offset < 0 || stack.stack_size < 0
+				|| stack.stack_size > (int) section.source_list.size() - stack.stack_offset)
+			return frames;
+		int num_strings = section.strings.size();
+		for (int i = stack.stack_size - 1; i >= 0; i--) {
+			struct runtime::d2x_source_loc loc = section.source_list[stack.stack_offset + i];
+			if (loc.function < 0 || loc.function >= num_strings || loc.filename < 0 || loc.filename >= num_strings)
+				continue;
+			frames.push_back(section.strings[loc.function] + "@" + basename(section.strings[loc.filename])
+				+ ":" + std::to_string(loc.linenumber));
+		}
+		return frames;
+	}
+	return frames;
+}
+
+static int run(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::cerr << "Usage: d2x-perf <binary> [--raw] [--flat <file>] [--folded <file>] [--dsl-only] [--threads <n>] < input" << std::endl;
+		return -1;
+	}
+	const char* binary = argv[1];
+	bool raw = false, dsl_only = false;
+	const char* flat_file = nullptr;
+	const char* folded_file = nullptr;
+	int num_threads = std::max(1u, std::thread::hardware_concurrency());
+	for (int i = 2; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--raw")
+			raw = true;
+		else if (arg == "--dsl-only")
+			dsl_only = true;
+		else if (arg == "--flat" && i + 1 < argc)
+			flat_file = argv[++i];
+		else if (arg == "--folded" && i + 1 < argc)
+			folded_file = argv[++i];
+		else if (arg == "--threads" && i + 1 < argc)
+			num_threads = std::max(1, atoi(argv[++i]));
+		else {
+			std::cerr << "Unknown option " << arg << std::endl;
+			return -1;
+		}
+	}
+
+	struct elf_file elf;
+	if (!load_elf(binary, elf)) {
+		std::cerr << "Failed to read " << binary << " as a 64 bit ELF file" << std::endl;
+		return -1;
+	}
+	std::vector<struct static_section> sections = read_sections(elf);
+	if (sections.empty())
+		std::cerr << "No D2X sections found in " << binary << std::endl;
+	// normalized generated file -> anchor line -> section, keyed like the runtime's file index
+	std::map<std::string, std::map<int, int>> index;
+	{
+		int fd = open(binary, O_RDONLY);
+		Dwarf_Debug dbg = NULL;
+		Dwarf_Error de;
+		if (fd >= 0 && dwarf_init(fd, DW_DLC_READ, NULL, NULL, &dbg, &de) != DW_DLV_OK)
+			dbg = NULL;
+		for (int i = 0; i < (int) sections.size(); i++) {
+			const struct static_section &section = sections[i];
+			std::string comp_dir;
+			if (dbg != NULL && section.identified_filename[0] != '/')
+				comp_dir = util::find_comp_dir(dbg, section.function_addr, section.identified_filename.c_str());
+			index[util::normalize_path(section.identified_filename, comp_dir)][section.identified_line] = i;
+		}
+		if (dbg != NULL)
+			dwarf_finish(dbg, &de);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	perf_reader reader(elf, binary);
+	if (raw)
+		reader.read_raw(std::cin);
+	else
+		reader.read_script(std::cin);
+
+	// Symbolize every distinct address once, in sorted batches so each thread walks
+	// neighbouring CUs
+	std::vector<uint64_t> addrs;
+	for (auto &s: reader.samples)
+		for (auto &f: s.frames)
+			if (f.in_binary)
+				addrs.push_back(f.vaddr);
+	std::sort(addrs.begin(), addrs.end());
+	addrs.erase(std::unique(addrs.begin(), addrs.end()), addrs.end());
+	std::vector<struct generated_line> lines(addrs.size(), {"", -1});
+	std::vector<std::thread> threads;
+	size_t batch = (addrs.size() + num_threads - 1) / num_threads;
+	for (size_t begin = 0; begin < addrs.size(); begin += batch)
+		threads.push_back(std::thread(symbolize_batch, binary, std::cref(addrs), begin,
+			std::min(begin + batch, addrs.size()), std::ref(lines)));
+	for (auto &t: threads)
+		t.join();
+
+	std::map<uint64_t, std::vector<std::string>> addr_frames;
+	for (size_t i = 0; i < addrs.size(); i++)
+		if (lines[i].line != -1)
+			addr_frames[addrs[i]] = dsl_frames(sections, index, lines[i]);
+
+	std::map<std::string, unsigned long long> self_counts, total_counts, folded;
+	for (auto &s: reader.samples) {
+		std::vector<std::string> stack;
+		std::string leaf = "[non-DSL]";
+		// Walk outermost to innermost
+		for (auto f = s.frames.rbegin(); f != s.frames.rend(); f++) {
+			auto dsl = f->in_binary ? addr_frames.find(f->vaddr) : addr_frames.end();
+			if (dsl != addr_frames.end() && !dsl->second.empty()) {
+				stack.insert(stack.end(), dsl->second.begin(), dsl->second.end());
+				leaf = dsl->second.back();
+			} else if (!dsl_only)
+				stack.push_back(f->symbol);
+		}
+		self_counts[leaf]++;
+		std::set<std::string> seen;
+		for (auto &frame: stack)
+			if (frame.find('@') != std::string::npos && seen.insert(frame).second)
+				total_counts[frame]++;
+		std::stringstream key;
+		for (size_t i = 0; i < stack.size(); i++)
+			key << (i ? ";" : "") << stack[i];
+		if (!stack.empty())
+			folded[key.str()]++;
+	}
+
+	std::vector<std::pair<unsigned long long, std::string>> order;
+	for (auto &c: self_counts)
+		order.push_back(std::make_pair(c.second, c.first));
+	for (auto &c: total_counts)
+		if (self_counts.find(c.first) == self_counts.end())
+			order.push_back(std::make_pair(0, c.first));
+	std::sort(order.rbegin(), order.rend());
+
+	std::stringstream flat;
+	double n = std::max<size_t>(1, reader.samples.size());
+	flat << "# " << reader.samples.size() << " samples, " << sections.size() << " D2X sections\n";
+	flat << "# self\tself%\ttotal\ttotal%\tlocation\n";
+	for (auto &o: order) {
+		unsigned long long total = total_counts.count(o.second) ? total_counts[o.second] : o.first;
+		flat << o.first << "\t" << 100.0 * o.first / n << "\t" << total << "\t" << 100.0 * total / n << "\t" << o.second << "\n";
+	}
+	if (flat_file == nullptr)
+		std::cout << flat.str();
+	else {
+		std::ofstream output(flat_file);
+		output << flat.str();
+	}
+	if (folded_file != nullptr) {
+		std::ofstream output(folded_file);
+		for (auto &f: folded)
+			output << f.first << " " << f.second << "\n";
+	}
+	return 0;
+}
+
+}
+}
+
+int main(int argc, char* argv[]) {
+	return d2x::perf::run(argc, argv);
+}
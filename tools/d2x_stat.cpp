@@ -0,0 +1,283 @@
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+/* d2x-stat merges the DSL extended stacks of many processes into one prefix tree, like STAT
+does for native stacks. Each input is a rank: the pid of a process running the introspection
+server, the path of its socket, or a file with output saved from such a socket earlier, e.g. by
+a job launcher when a run times out. Stacks are read outermost frame first, so ranks that share
+a call path share a branch and a rank that is somewhere else stands out as a branch of its own.
+Every node lists how many ranks (and threads) reached it and which ones.
+
+Usage: d2x-stat [options] <pid|socket|file>...
+	--socket <pattern>	socket path of a pid, %p is replaced with the pid. Defaults to
+				D2X_INTROSPECT_SOCKET or /tmp/d2x-%p.sock
+	--threads <n>		number of inputs collected in parallel
+	--timeout <ms>		time to wait for each process to reply
+	--leaves		only print the leaves, one line per distinct stack
+
+Core files are not read yet. Their DSL stacks can be recovered offline like d2x-perf does for
+samples, by unwinding the threads from NT_PRSTATUS and mapping the native frames through the
+D2X tables of the binary, but d2x-stat does not implement that */
+
+namespace d2x {
+namespace stacks {
+
+struct stack_node {
+	// Ranks in increasing order, each counted once
+	std::vector<int> ranks;
+	int threads = 0;
+	// Ranks and threads whose stacks end at this node
+	std::vector<int> ending_ranks;
+	int ending_threads = 0;
+	std::map<std::string, struct stack_node> children;
+};
+
+struct rank_input {
+	std::string name;
+	std::string output;
+	bool reachable = false;
+};
+
+static std::string socket_path(const std::string &pattern, const std::string &pid) {
+	std::string path = pattern;
+	size_t pos;
+	while ((pos = path.find("%p")) != std::string::npos)
+		path.replace(pos, 2, pid);
+	return path;
+}
+
+static bool read_socket(const std::string &path, int timeout_ms, std::string &output) {
+	struct sockaddr_un addr;
+	if (path.size() >= sizeof(addr.sun_path))
+		return false;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return false;
+	struct timeval tv;
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+	if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+		close(fd);
+		return false;
+	}
+	char buffer[4096];
+	ssize_t ret;
+	while ((ret = read(fd, buffer, sizeof(buffer))) > 0)
+		output.append(buffer, ret);
+	close(fd);
+	// A timeout before anything was read means the process is not serving
+	return ret == 0 || !output.empty();
+}
+
+static void collect(struct rank_input &input, const std::string &pattern, int timeout_ms) {
+	std::string path = input.name;
+	if (!path.empty() && std::all_of(path.begin(), path.end(), ::isdigit))
+		path = socket_path(pattern, path);
+	struct ::stat st;
+	if (::stat(path.c_str(), &st) != 0)
+		return;
+	if (S_ISSOCK(st.st_mode)) {
+		input.reachable = read_socket(path, timeout_ms, input.output);
+		return;
+	}
+	std::ifstream file(path);
+	std::stringstream contents;
+	contents << file.rdbuf();
+	input.output = contents.str();
+	input.reachable = file.good() || file.eof();
+	if (input.output.compare(0, 4, "\x7f" "ELF") == 0)
+		input.output = "(core files are not supported)\n";
+}
+
+static void add_rank(struct stack_node &node, int rank) {
+	if (node.ranks.empty() || node.ranks.back() != rank)
+		node.ranks.push_back(rank);
+}
+
+// Adds one thread stack, innermost frame first as printed by the introspection server
+static void add_stack(struct stack_node &root, int rank, const std::vector<std::string> &frames) {
+	struct stack_node* node = &root;
+	add_rank(*node, rank);
+	node->threads++;
+	for (auto frame = frames.rbegin(); frame != frames.rend(); frame++) {
+		node = &node->children[*frame];
+		add_rank(*node, rank);
+		node->threads++;
+	}
+	if (node->ending_ranks.empty() || node->ending_ranks.back() != rank)
+		node->ending_ranks.push_back(rank);
+	node->ending_threads++;
+}
+
+// Frame lines look like "\t#<index> in <frame>", other indented lines stand for the whole stack
+static void add_rank_output(struct stack_node &root, int rank, const std::string &output) {
+	std::stringstream lines(output);
+	std::string line;
+	std::vector<std::string> frames;
+	bool in_thread = false;
+	while (std::getline(lines, line)) {
+		if (line.compare(0, 7, "Thread ") == 0) {
+			if (in_thread)
+				add_stack(root, rank, frames);
+			frames.clear();
+			in_thread = true;
+			continue;
+		}
+		if (line.empty() || line[0] != '\t') {
+			if (!line.empty()) {
+				// Errors of the whole process
+				add_stack(root, rank, {line});
+				in_thread = false;
+			}
+			continue;
+		}
+		line = line.substr(1);
+		size_t in = line.find(" in ");
+		if (line[0] == '#' && in != std::string::npos)
+			frames.push_back(line.substr(in + 4));
+		else
+			frames.push_back(line);
+	}
+	if (in_thread)
+		add_stack(root, rank, frames);
+}
+
+// Ranks as compact ranges, "0-3,7,9-12"
+static std::string rank_ranges(const std::vector<int> &ranks) {
+	std::stringstream oss;
+	for (size_t i = 0; i < ranks.size(); i++) {
+		size_t j = i;
+		while (j + 1 < ranks.size() && ranks[j + 1] == ranks[j] + 1)
+			j++;
+		oss << (i ? "," : "") << ranks[i];
+		if (j > i)
+			oss << "-" << ranks[j];
+		i = j;
+	}
+	return oss.str();
+}
+
+static std::string node_label(const std::vector<int> &ranks, int threads) {
+	std::stringstream oss;
+	oss << ranks.size() << ":[" << rank_ranges(ranks) << "]";
+	if (threads != (int) ranks.size())
+		oss << " " << threads << " threads";
+	return oss.str();
+}
+
+// Children with more ranks first, so the common path is at the top and outliers at the bottom
+static std::vector<const std::pair<const std::string, struct stack_node>*> sorted_children(const struct stack_node &node) {
+	std::vector<const std::pair<const std::string, struct stack_node>*> children;
+	for (auto &c: node.children)
+		children.push_back(&c);
+	std::stable_sort(children.begin(), children.end(), [](const std::pair<const std::string, struct stack_node>* a,
+			const std::pair<const std::string, struct stack_node>* b) {
+		return a->second.ranks.size() > b->second.ranks.size();
+	});
+	return children;
+}
+
+static void print_tree(std::ostream &oss, const struct stack_node &node, int depth) {
+	for (auto c: sorted_children(node)) {
+		oss << std::string(depth * 2, ' ') << node_label(c->second.ranks, c->second.threads) << " " << c->first << "\n";
+		print_tree(oss, c->second, depth + 1);
+	}
+}
+
+// Nodes where stacks end, with the frames leading to them outermost first separated by ';'
+static void print_leaves(std::ostream &oss, const struct stack_node &node, const std::string &path) {
+	if (node.ending_threads > 0 && path != "")
+		oss << node_label(node.ending_ranks, node.ending_threads) << " " << path << "\n";
+	for (auto c: sorted_children(node))
+		print_leaves(oss, c->second, path == "" ? c->first : path + ";" + c->first);
+}
+
+static int run(int argc, char* argv[]) {
+	std::string pattern = getenv("D2X_INTROSPECT_SOCKET") ? getenv("D2X_INTROSPECT_SOCKET") : "/tmp/d2x-%p.sock";
+	int num_threads = std::max(1u, std::thread::hardware_concurrency()) * 4;
+	int timeout_ms = 2000;
+	bool leaves = false;
+	std::vector<struct rank_input> inputs;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--socket" && i + 1 < argc)
+			pattern = argv[++i];
+		else if (arg == "--threads" && i + 1 < argc)
+			num_threads = std::max(1, atoi(argv[++i]));
+		else if (arg == "--timeout" && i + 1 < argc)
+			timeout_ms = std::max(1, atoi(argv[++i]));
+		else if (arg == "--leaves")
+			leaves = true;
+		else if (arg.compare(0, 2, "--") == 0) {
+			std::cerr << "Unknown option " << arg << std::endl;
+			return -1;
+		} else {
+			inputs.push_back(rank_input());
+			inputs.back().name = arg;
+		}
+	}
+	if (inputs.empty()) {
+		std::cerr << "Usage: d2x-stat [--socket <pattern>] [--threads <n>] [--timeout <ms>] [--leaves] <pid|socket|file>..." << std::endl;
+		std::cerr << "Files hold output saved from an introspection socket, core files are not supported" << std::endl;
+		return -1;
+	}
+
+	// Processes are sampled concurrently so a slow or hung rank only delays its own worker
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < std::min<int>(num_threads, inputs.size()); t++) {
+		threads.push_back(std::thread([&]() {
+			size_t i;
+			while ((i = next++) < inputs.size())
+				collect(inputs[i], pattern, timeout_ms);
+		}));
+	}
+	for (auto &t: threads)
+		t.join();
+
+	struct stack_node root;
+	int unreachable = 0;
+	for (int rank = 0; rank < (int) inputs.size(); rank++) {
+		if (!inputs[rank].reachable) {
+			add_stack(root, rank, {"(unreachable)"});
+			unreachable++;
+			continue;
+		}
+		add_rank_output(root, rank, inputs[rank].output);
+	}
+
+	std::cout << "# " << inputs.size() << " ranks, " << unreachable << " unreachable\n";
+	if (leaves)
+		print_leaves(std::cout, root, "");
+	else
+		print_tree(std::cout, root, 0);
+	std::cout << "# Ranks are input positions\n";
+	for (int rank = 0; rank < (int) inputs.size(); rank++)
+		std::cout << "#\t" << rank << " " << inputs[rank].name << "\n";
+	return 0;
+}
+
+}
+}
+
+int main(int argc, char* argv[]) {
+	return d2x::stacks::run(argc, argv);
+}